@@ -12,6 +12,8 @@
 
 #include "ads_dump.h"
 
+#include <pthread.h>
+
 
 /* LEB Number to dump in cas it was specifed by arg */
 static int lebToDump = -1;
@@ -20,9 +22,12 @@ static int lebToDump = -1;
 /* Extension name to find in cas we want to extract file */
 #define EXTENSION_TO_DUMP (".json")
 
-/* MTD device to use to find PEB <-> LEB association */
+/* Default MTD device to use to find PEB <-> LEB association */
 #define MTD_DEVICE ("/dev/mtd1")
 
+/* MTD device to use to find PEB <-> LEB association */
+static const char *mtdDevice = MTD_DEVICE;
+
 /* The nanddump script filename */
 #define NANDUMP_FILENAME ("/home/root/nand_dump.shell")
 
@@ -47,14 +52,68 @@ fileToDumpList[50];
 
 /* malloc allocated size for a data node */
 #define DATA_NODE_SIZE (64536)
-/* Point to a malloc area to store data_node (size is DATA_NODE_SIZE) */
-static struct ubifs_data_node *data_node = NULL;
 
-/* Empty page: usefull when a data entry not found */
-static uint8_t *emptyBlock = NULL;
+/* Number of data blocks located and read at once by extract_file */
+#define EXTRACT_WINDOW (64)
 
-/* File descriptor for the shell file to generate extracted file, out of this sw with nanddump */
-static FILE *fdShell = NULL;
+/* Data nodes of a window of blocks of the file to extract */
+struct extract_window
+{
+	/* First block and number of blocks */
+	int first;
+	int nb;
+
+	struct
+	{
+		/* 0: node in dn, -ENOENT: hole, -EAGAIN: use ads_tnc_read_node */
+		int err;
+		int lnum;
+		int offs;
+		const struct ubifs_data_node *dn;
+	}
+	blk[EXTRACT_WINDOW];
+
+	/* Read nodes, EXTRACT_WINDOW * UBIFS_MAX_DATA_NODE_SZ */
+	uint8_t *buf;
+
+	/* Queue of the reads of the thread (io_uring with -U) */
+	struct leb_aio *aio;
+
+	/* Data nodes of the file, in block order */
+	struct ads_tnc_iter   it;
+	/* Extent returned by the iterator, not used yet (after the window) */
+	struct ads_tnc_extent pending;
+	int hasPending;
+	/* Error of the iterator: blocks read by ads_tnc_read_node */
+	int itErr;
+};
+
+/* State of a thread extracting files */
+struct extract_worker
+{
+	/* Point to a malloc area to store data_node (size is DATA_NODE_SIZE) */
+	struct ubifs_data_node *data_node;
+
+	struct extract_window window;
+};
+
+/* Output of the extraction of a file, printed in the order of the list */
+struct extract_output
+{
+	/* Log of the extraction */
+	char  *log;
+	size_t logSize;
+
+	/* Lines of the nanddump script */
+	char  *script;
+	size_t scriptSize;
+
+	/* Digests of the file, NULL if none */
+	struct file_hash *hash;
+};
+
+/* Threads extracting the files of the list, 0: the main thread only */
+static int extractThreads = 0;
 
 
 
@@ -103,85 +162,60 @@ static int isFileToDump(char *name)
 /**
  * Print information of a LEB
  *
+ * out: where to print
  * block: only for printf, to identify the block number
- * data_node: the data node to locate
+ * data_node: the data node, located by ads_tnc_read_node
  * pnum: To store the Physical Erasable Block location
- * lnum: To store the logical Erasable Block Location
- * pebOffs: Offset of data's relative to a PEB
+ * lnum: the logical Erasable Block Location
+ * pebOffs: To store the offset of data's relative to a PEB
  * lebOffs: Offset of data's relative of a LEB
  * size: only for printf, size of thhe data containing in this node
  */
 static void printLEB(
-		struct ubifs_info *c,
+		FILE *out,
 	       	int block,
-	       	struct ubifs_data_node *data_node,
+	       	const struct ubifs_data_node *data_node,
 		int *pnum,
-		int *lnum,
+		int lnum,
 		int *pebOffs,
-		int *lebOffs,
+		int lebOffs,
 		int size)
 {
-	struct ubifs_ch *ch;
-	union ubifs_key key;
-	int err;
-	
-	/* Generate the key to looking for */
-	key_read(c, &data_node->key, &key);
-	
-	/* Alloc area for the function ubifs_tnc_locate */
-	ch = malloc(data_node->ch.len);
+	/* Using PEB LEB helper to known the physical PEB */
+	(*pnum )   = peb_leb_getPeb(lnum);
 
-	/* Use the lib ubifs function to obtain the node + LEB + LEB offset */
-	/* In case of success return 0 */
-	err = ubifs_tnc_locate(c, &key, ch, lnum, lebOffs);
-	if (err != 0)
+	/* Compute the PEB offset */
+	(*pebOffs) = 0;
+	if ( (*pnum) >= 0)
 	{
-		/* Notify user of the error, usually ENOENT */
-		printf("Error ubifs_tnc_locate block=%d err=%d (%s)\n",
-			block,
-			err,
-			strerror(err));
-		(*lnum)    = -1;
-		(*pebOffs) = -1;
-		(*lebOffs) = -1;
+		(*pebOffs) = peb_leb_getDataOffset(*pnum) + lebOffs;
 	}
-	else
-	{
-		/* Using PEB LEB helper to known the physical PEB */
-                (*pnum )   = peb_leb_getPeb(*lnum);
-	
-		/* Compute the PEB offset */
-		(*pebOffs) = 0;
-		if ( (*pnum) >= 0)
-		{
-			(*pebOffs) = peb_leb_getDataOffset(*pnum) + (*lebOffs);
-		}
 
-		/* offset is data node (header + data), keep in mind the header */
-		printf(
-				"block #%d %s PEB %d:%d LEB %d:%d size:%d\n",
-				block,
-				dbg_ntype(ch->node_type),
-				(*pnum),
-				(*pebOffs),
-				(*lnum),
-				(*lebOffs),
-				size);
-	}
-	/* Return the allocated area */
-	free(ch);
+	/* offset is data node (header + data), keep in mind the header */
+	fprintf(
+			out,
+			"block #%d %s PEB %d:%d LEB %d:%d size:%d\n",
+			block,
+			dbg_ntype(data_node->ch.node_type),
+			(*pnum),
+			(*pebOffs),
+			lnum,
+			lebOffs,
+			size);
 }
 
 /**
  * Print information about the inode
  *
+ * out: where to print
  * inode: inode number to print
  * Return the size field.
  */
-uint64_t ads_print_ino_node(struct ubifs_info *c, uint64_t inode)
+uint64_t ads_fprint_ino_node(FILE *out, struct ubifs_info *c, uint64_t inode)
 {
 	uint64_t inoSize = ~0;
-	struct ubifs_ino_node *pInode;
+	const struct ubifs_ino_node *pInode;
+	void *buf;
 	union ubifs_key key;
 	char modeStr[100];
 	int lnum;
@@ -189,13 +223,13 @@ uint64_t ads_print_ino_node(struct ubifs_info *c, uint64_t inode)
 	int err;
 
 	/* Alloc more space */
-	pInode = malloc(8192+sizeof(struct ubifs_ino_node));
+	buf = malloc(8192+sizeof(struct ubifs_ino_node));
 
 	/* Generate an inode key */	
 	ino_key_init(c, &key, inode);
 
-	/* Use lib ubifs to find the key */
-	err = ubifs_tnc_lookup(c, &key, pInode);
+	/* Find the key, read the node and its location at once */
+	err = ads_tnc_read_node(c, &key, buf, (const void **)&pInode, &lnum, &offs);
 	if (0 == err)
 	{
 		/* Generate a nice sightseeing */
@@ -216,144 +250,436 @@ uint64_t ads_print_ino_node(struct ubifs_info *c, uint64_t inode)
                                  (pInode->mode&(1<<1))?'w':'-',
                                  (pInode->mode&(1<<0))?'x':'-');
 
-		printf("ino_inode: size:%lld %s uid=%d gid=%d\n",
+		fprintf(out, "ino_inode: size:%lld %s uid=%d gid=%d\n",
 				pInode->size,
 				modeStr,
 				pInode->uid,
 				pInode->gid);
 
 		inoSize = pInode->size;
+
+		/* Print the ino inode location */
+		fprintf(out, "ino_inode: LEB:%d:%d, PEB:%d\n",lnum, offs, peb_leb_getPeb(lnum));
 	}
 	else
 	{
 		/* Error case */
-		printf("%s: Unable to find:%lld err=%d (%s)\n",
+		fprintf(out, "%s: Unable to find:%lld err=%d (%s)\n",
 			__FUNCTION__,
 			inode,
 			err,
 			strerror(err));
 	}
 
-	/* Re generate a key to locate the LEB (code from linux driver) */
-	key_read(c, &pInode->key, &key);
-	err = ubifs_tnc_locate(c, &key, pInode, &lnum, &offs);
-        if (err != 0)
+	// Return memory (for help: man free) */
+	free(buf);
+
+	return inoSize;
+}
+
+/**
+ * Print information about the inode on stdout
+ */
+uint64_t ads_print_ino_node(struct ubifs_info *c, uint64_t inode)
+{
+	return ads_fprint_ino_node(stdout, c, inode);
+}
+
+/**
+ * Print a hole of a file: count blocks without data node from first
+ *
+ * out: where to print
+ * Return the size of the hole in the file (the last block is cut at the end)
+ */
+uint64_t ads_fprint_hole(FILE *out, const char *name, unsigned int first, unsigned int count, uint64_t fileSize)
+{
+	uint64_t start = (uint64_t)first * UBIFS_BLOCK_SIZE;
+	uint64_t end   = (uint64_t)(first + count) * UBIFS_BLOCK_SIZE;
+
+	if (end > fileSize)
 	{
-		/* Error not found */
-		printf("Error ubifs_tnc_locate ino_inode err=%d (%s)\n", err, strerror(err));
+		end = fileSize;
 	}
-	else
+	if (start >= end)
 	{
-		/* Print the ino inode location */
-		printf("ino_inode: LEB:%d:%d, PEB:%d\n",lnum, offs, peb_leb_getPeb(lnum));
+		return 0;
 	}
-	// Return memory (for help: man free) */
-	free(pInode);
+	fprintf(out, "Hole file:%s blocks:%u-%u offset:0x%llX size:%llu\n",
+			name,
+			first,
+			first + count - 1,
+			(unsigned long long)start,
+			(unsigned long long)(end - start));
+	return end - start;
+}
 
-	return inoSize;
+/**
+ * Get the metadata of an inode
+ * Return 0 or an error of the TNC
+ */
+int ads_get_ino_info(struct ubifs_info *c, uint64_t inode, struct ads_ino_info *info)
+{
+	const struct ubifs_ino_node *ino;
+	union ubifs_key key;
+	void *buf;
+	int lnum;
+	int offs;
+	int err;
+
+	buf = malloc(UBIFS_MAX_INO_NODE_SZ);
+	if (buf == NULL)
+	{
+		return -ENOMEM;
+	}
+
+	ino_key_init(c, &key, inode);
+	err = ads_tnc_read_node(c, &key, buf, (const void **)&ino, &lnum, &offs);
+	if (err == 0)
+	{
+		info->size  = le64_to_cpu(ino->size);
+		info->mode  = le32_to_cpu(ino->mode);
+		info->uid   = le32_to_cpu(ino->uid);
+		info->gid   = le32_to_cpu(ino->gid);
+		info->nlink = le32_to_cpu(ino->nlink);
+		info->mtime = le64_to_cpu(ino->mtime_sec);
+	}
+	free(buf);
+	return err;
+}
+
+/**
+ * Check the key of a data node is the one of the block
+ */
+static int extract_node_key_ok(
+		struct ubifs_info *c,
+		const struct ubifs_data_node *dn,
+		uint64_t inum,
+		int block)
+{
+	union ubifs_key key;
+	union ubifs_key nodeKey;
+
+	data_key_init(c, &key, inum, block);
+	key_read(c, &dn->key, &nodeKey);
+	return keys_cmp(c, &key, &nodeKey) == 0;
+}
+
+/**
+ * Get the data nodes of nb blocks of the file from the TNC iterator and
+ * read them with the read planner (one read for the nodes sharing flash
+ * pages), or use them in place in a memory mapped image
+ * A node not readable or not valid is marked to be read by ads_tnc_read_node,
+ * which prints the error
+ */
+static void extract_window_load(
+		struct ubifs_info *c,
+		struct extract_window *window,
+		uint64_t inum,
+		int first,
+		int nb)
+{
+	struct read_plan_req reqs[EXTRACT_WINDOW];
+	struct ads_tnc_extent *ext = &window->pending;
+	const struct ubifs_data_node *dn;
+	int image = peb_leb_is_image();
+	int nbReqs = 0;
+	int ret;
+	int n;
+	int i;
+
+	window->first = first;
+	window->nb    = nb;
+
+	/* Blocks without node are holes */
+	for (i=0; i<nb; i++)
+	{
+		window->blk[i].err  = window->itErr ? -EAGAIN : -ENOENT;
+		window->blk[i].dn   = NULL;
+		window->blk[i].lnum = -1;
+		window->blk[i].offs = -1;
+	}
+
+	if ( (!image) && (window->buf == NULL) )
+	{
+		window->buf = malloc(EXTRACT_WINDOW * UBIFS_MAX_DATA_NODE_SZ);
+	}
+	if ( (!image) && (window->aio == NULL) )
+	{
+		window->aio = leb_aio_open(c, EXTRACT_WINDOW);
+	}
+
+	while (!window->itErr)
+	{
+		if (!window->hasPending)
+		{
+			ret = ads_tnc_iter_next(&window->it, ext);
+			if (ret < 0)
+			{
+				/* Let ads_tnc_read_node report the error */
+				window->itErr = ret;
+				for (i=0; i<nb; i++)
+				{
+					window->blk[i].err = -EAGAIN;
+				}
+				return;
+			}
+			if (ret == 0)
+			{
+				break;
+			}
+			window->hasPending = 1;
+		}
+
+		/* After the window: kept for the next one */
+		if (ext->block >= (unsigned int)(first + nb))
+		{
+			break;
+		}
+
+		if (ext->lnum < 0)
+		{
+			/* Hole continuing in the next window */
+			if (ext->block + ext->count > (unsigned int)(first + nb))
+			{
+				ext->count -= first + nb - ext->block;
+				ext->block  = first + nb;
+				break;
+			}
+			window->hasPending = 0;
+			continue;
+		}
+		window->hasPending = 0;
+
+		i = ext->block - first;
+		window->blk[i].err  = -EAGAIN;
+		window->blk[i].lnum = ext->lnum;
+		window->blk[i].offs = ext->offs;
+
+		if (image)
+		{
+			/* Memory mapped image: node used in place, nothing to read */
+			dn = ubifs_map_node(c, UBIFS_DATA_NODE, ext->len, ext->lnum, ext->offs);
+			if ( (dn != NULL) && extract_node_key_ok(c, dn, inum, ext->block) )
+			{
+				window->blk[i].dn  = dn;
+				window->blk[i].err = 0;
+			}
+		}
+		else if ( (window->buf != NULL) && (ext->len <= UBIFS_MAX_DATA_NODE_SZ) )
+		{
+			reqs[nbReqs].lnum = ext->lnum;
+			reqs[nbReqs].offs = ext->offs;
+			reqs[nbReqs].len  = ext->len;
+			reqs[nbReqs].buf  = window->buf + i * UBIFS_MAX_DATA_NODE_SZ;
+			nbReqs++;
+		}
+	}
+
+	/* Without queue the nodes are read by ads_tnc_read_node */
+	if ( (nbReqs == 0) || (window->aio == NULL) )
+	{
+		return;
+	}
+
+	if (read_plan_execute(c, window->aio, reqs, nbReqs))
+	{
+		return;
+	}
+
+	/* Check the nodes, like ubifs_tnc_read_node */
+	for (n=0; n<nbReqs; n++)
+	{
+		i  = ((uint8_t *)reqs[n].buf - window->buf) / UBIFS_MAX_DATA_NODE_SZ;
+		dn = reqs[n].buf;
+
+		if ( (reqs[n].err != 0) ||
+		     (dn->ch.node_type != UBIFS_DATA_NODE) ||
+		     (le32_to_cpu(dn->ch.len) != reqs[n].len) ||
+		     ubifs_check_node(c, dn, reqs[n].len, reqs[n].lnum, reqs[n].offs, 1, 0) ||
+		     !extract_node_key_ok(c, dn, inum, first + i) )
+		{
+			continue;
+		}
+		window->blk[i].dn  = dn;
+		window->blk[i].err = 0;
+	}
 }
 
 /**
  * Generate the file to extract in /home/root/
  * Generate a nanddump script
+ *
+ * w: state of the thread
+ * out: where to print the log
+ * shell: where to write the lines of the nanddump script, NULL if none
+ * hash: digests of the data written, NULL if none
  */
-static void extract_file(struct ubifs_info *c, struct ubifs_dent_node *node)
+static void extract_file(
+		struct ubifs_info *c,
+		struct extract_worker *w,
+		struct ubifs_dent_node *node,
+		FILE *out,
+		FILE *shell,
+		struct file_hash *hash)
 {
+	struct extract_window *window = &w->window;
 	char outFile[400];
-	char command[500];
 	union ubifs_key key;
 	int          err;
 	int          block = 0;
 	unsigned int partSize;
 	uint64_t     extractedSize = 0;
 	FILE        *fd;
+	struct decomp_pipe *pipe;
+	struct ads_ino_info info;
 	int          lnum;
         int          pebOffs;
 	int          lebOffs;
 	int          pnum;
 	uint64_t     fileSize;
 	uint64_t     leftSize;
+	int          writeLen;
+	int64_t      nbBlocks;
+	int          holeFirst = -1;
+	unsigned int nbHoles = 0;
+	uint64_t     holeSize = 0;
+	const struct ubifs_data_node *dn;
 
-	fileSize = ads_print_ino_node(c, node->inum);
-	printf("Extract file:%s size:%lld\n", node->name, fileSize);
+	fileSize = ads_fprint_ino_node(out, c, node->inum);
+	fprintf(out, "Extract file:%s size:%lld\n", node->name, fileSize);
 
-	/* Open the file to extract */
-	sprintf(outFile, "/home/root/%s", node->name);
-	fd = fopen(outFile, "w");
-	if (fd == NULL)
+	if (archive_is_enabled())
 	{
-		printf("Unable to open file to write\n");
-		return;
+		/* Streamed in the archive, with the metadata of the inode */
+		err = ads_get_ino_info(c, node->inum, &info);
+		if (err == 0)
+		{
+			info.size = fileSize;
+			err = archive_file_begin((const char *)node->name, &info);
+		}
+		if (err)
+		{
+			fprintf(out, "Unable to add the file to the archive err:%d\n", err);
+			return;
+		}
+		fd = archive_stream();
+	}
+	else
+	{
+		/* Open the file to extract */
+		sprintf(outFile, "/home/root/%s", node->name);
+		fd = fopen(outFile, "w");
+		if (fd == NULL)
+		{
+			fprintf(out, "Unable to open file to write\n");
+			return;
+		}
 	}
 
-	/* Alloc a static variable if not allocated */
-	if (data_node == NULL)
+	/* Blocks expanded (LZO, zlib, zstd) and written in order,
+	 * holes skipped in a file (the archive stream can't seek) */
+	pipe = decomp_pipe_open(fd, out, hash, !archive_is_enabled());
+	if (pipe == NULL)
 	{
-		data_node = malloc(DATA_NODE_SIZE);
+		fprintf(out, "Unable to start the decompression\n");
+		if (!archive_is_enabled())
+		{
+			fclose(fd);
+		}
+		return;
 	}
-	/* Alloc zero block */
-	if (emptyBlock == NULL)
+
+	/* Alloc the buffers of the thread if not allocated */
+	if (w->data_node == NULL)
 	{
-		
-		emptyBlock = calloc(1, UBIFS_BLOCK_SIZE);
+		w->data_node = malloc(DATA_NODE_SIZE);
 	}
+	/* No block loaded for this file */
+	window->first      = 0;
+	window->nb         = 0;
+	window->hasPending = 0;
+	window->itErr      = ads_tnc_iter_init(
+					c,
+					&window->it,
+					node->inum,
+					0,
+					(fileSize + UBIFS_BLOCK_SIZE - 1) / UBIFS_BLOCK_SIZE);
 
 	/* Extract all the file */
 	while (extractedSize < fileSize)
 	{
-		/*  Generate a data key */
-		data_key_init(c, &key, node->inum, block);
-		/* Use the lib ubifs function to lookup */
-		err = ubifs_tnc_lookup(c, &key, data_node);
+		/* Locate and read the next blocks at once */
+		if (block >= window->first + window->nb)
+		{
+			nbBlocks = (fileSize + UBIFS_BLOCK_SIZE - 1) / UBIFS_BLOCK_SIZE - block;
+			if (nbBlocks < 1)
+			{
+				nbBlocks = 1;
+			}
+			extract_window_load(
+					c,
+					window,
+					node->inum,
+					block,
+					(nbBlocks < EXTRACT_WINDOW) ? nbBlocks : EXTRACT_WINDOW);
+		}
+		err     = window->blk[block - window->first].err;
+		dn      = window->blk[block - window->first].dn;
+		lnum    = window->blk[block - window->first].lnum;
+		lebOffs = window->blk[block - window->first].offs;
+
+		if (err == -EAGAIN)
+		{
+			/*  Generate a data key */
+			data_key_init(c, &key, node->inum, block);
+			/* Read the node and its location at once */
+			err  = ads_tnc_read_node(c, &key, w->data_node, (const void **)&dn, &lnum, &lebOffs);
+		}
+
+		/* Each block is UBIFS_BLOCK_SIZE in the file, except the last one */
+		leftSize = fileSize - extractedSize;
+		writeLen = (leftSize >= UBIFS_BLOCK_SIZE) ? UBIFS_BLOCK_SIZE : leftSize;
+		extractedSize += UBIFS_BLOCK_SIZE;
+
+		/* End of a run of missing blocks */
+		if ( (err != -ENOENT) && (holeFirst >= 0) )
+		{
+			holeSize += ads_fprint_hole(out, (const char *)node->name, holeFirst, block - holeFirst, fileSize);
+			nbHoles++;
+			holeFirst = -1;
+		}
 
 		if (err == -ENOENT)
 		{
-			/* NO ENTRY: page with zero */
-			if (fd != NULL)
+			/* NO ENTRY: hole, page with zero not written */
+			if (holeFirst < 0)
 			{
-				leftSize = fileSize - extractedSize;
-				if (1 != fwrite(
-					emptyBlock,
-					(leftSize>=UBIFS_BLOCK_SIZE) ? UBIFS_BLOCK_SIZE : leftSize,
-					1,
-					fd))
-				{
-					printf("Unable to write file\n");
-					fclose(fd);
-					fd = NULL;
-				}
+				holeFirst = block;
 			}
-			extractedSize += UBIFS_BLOCK_SIZE;
+			decomp_pipe_push(pipe, NULL, 0, writeLen);
 		}
 		else if (err)
 		{
-			printf("ubifs_tnc_lookup err:0x%X (%s)\n", err, strerror(err));
-			extractedSize += UBIFS_BLOCK_SIZE;
+			fprintf(out, "ads_tnc_read_node err:0x%X (%s)\n", err, strerror(err));
+			/* Unreadable: page with zero, to keep the next blocks in place */
+			decomp_pipe_push(pipe, NULL, 0, writeLen);
 		}
 		else
 		{
-			/* Compute the size of the data */
-			partSize = le32_to_cpu(data_node->ch.len) - UBIFS_DATA_NODE_SZ;
-			extractedSize += partSize;
+			/* Compute the size of the data on the flash */
+			partSize = le32_to_cpu(dn->ch.len) - UBIFS_DATA_NODE_SZ;
 
-			if (fd)
-			{
-				if (1 != fwrite(data_node->data,  partSize, 1, fd))
-				{
-					printf("Unable to write file\n");
-					fclose(fd);
-					fd = NULL;
-				}
-			}
+			decomp_pipe_push(pipe, dn, le32_to_cpu(dn->ch.len), writeLen);
 
 			pnum = -1;
-			printLEB(c, block, data_node, &pnum, &lnum, &pebOffs, &lebOffs, partSize);
+			printLEB(out, block, dn, &pnum, lnum, &pebOffs, lebOffs, partSize);
 
-			if ( (pnum >= 0) && (fdShell != NULL) )
+			if ( (pnum >= 0) && (shell != NULL) )
 			{
 				fprintf(
-						fdShell,
-					       	"nanddump /dev/mtd1 -s 0x%llX -l %d | tail -c %d | dd bs=%d count=1 >> /home/root/%s.nanddDmp\n",
+						shell,
+					       	"nanddump %s -s 0x%llX -l %d | tail -c %d | dd bs=%d count=1 >> /home/root/%s.nanddDmp\n",
+						mtdDevice,
 						(uint64_t)peb_leb_get_eb_size()*pnum,
 						peb_leb_get_eb_size(),
 						peb_leb_get_eb_size()-pebOffs-offsetof(struct ubifs_data_node,data),
@@ -365,53 +691,318 @@ static void extract_file(struct ubifs_info *c, struct ubifs_dent_node *node)
 		block++;
 	}
 
-	if (fd != NULL)
+	if (holeFirst >= 0)
+	{
+		holeSize += ads_fprint_hole(out, (const char *)node->name, holeFirst, block - holeFirst, fileSize);
+		nbHoles++;
+	}
+	if (nbHoles > 0)
+	{
+		fprintf(out, "Holes: %u, %llu bytes %s\n",
+				nbHoles,
+				(unsigned long long)holeSize,
+				archive_is_enabled() ? "written as zero" : "not written");
+	}
+
+	err = decomp_pipe_close(pipe);
+	if (err < 0)
+	{
+		fprintf(out, "Unable to write file\n");
+	}
+	else if (err > 0)
+	{
+		fprintf(out, "%d blocks not decompressed\n", err);
+	}
+	if (archive_is_enabled())
+	{
+		archive_file_end(&info);
+	}
+	else
 	{
 		fclose(fd);
-		fd = NULL;
 	}
+}
 
-	sprintf(command, "md5sum %s", outFile);
-	printf("exe cmd:%s\n", command);
-	fflush(stdout);
-	system(command);
+/**
+ * Digests of an extracted file: printed and added to the manifest
+ * hash: computed while writing the file, NULL if none (freed)
+ */
+static void extract_digest(struct file_hash *hash, struct ubifs_dent_node *node)
+{
+	char path[400];
+
+	if (hash == NULL)
+	{
+		return;
+	}
+
+	/* Name in the archive, or the extracted file */
+	if (archive_is_enabled())
+	{
+		snprintf(path, sizeof(path), "%s", node->name);
+	}
+	else
+	{
+		snprintf(path, sizeof(path), "/home/root/%s", node->name);
+	}
+	file_hash_final(hash);
+	file_hash_print(stdout, hash, path);
+	file_hash_manifest_add(hash, path);
+	file_hash_free(hash);
 }
 
 /**
- *
- *
+ * Digests of the files
  */
-static void extract_files_list(struct ubifs_info *c)
+static struct file_hash *extract_hash_new(void)
 {
+	return file_hash_is_enabled() ? file_hash_new() : NULL;
+}
+
+/**
+ * Copy a text file to stdout
+ */
+static void extract_print_file(const char *path)
+{
+	char  buf[4096];
+	size_t len;
+	FILE *fd;
+
+	fd = fopen(path, "r");
+	if (fd == NULL)
+	{
+		printf("Unable to open %s\n", path);
+		return;
+	}
+	while ((len = fread(buf, 1, sizeof(buf), fd)) > 0)
+	{
+		fwrite(buf, 1, len, stdout);
+	}
+	fclose(fd);
+}
+
+/* Work shared by the extraction threads */
+static struct
+{
+	struct ubifs_info *c;
+
+	/* Next file of the list to extract */
+	int next;
+
+	/* Output of each file of the list */
+	struct extract_output *outputs;
+}
+extractPool;
+
+/**
+ * Extraction thread: extract the next file of the list until the end,
+ * the log and the script lines of each file are kept for the main thread
+ */
+static void *extract_thread(void *arg)
+{
+	struct extract_worker w;
+	struct extract_output *o;
+	FILE *out;
+	FILE *shell;
 	int i;
-	char command[500];
 
-	fdShell = fopen(NANDUMP_FILENAME, "w");
-	if (fdShell == NULL)
+	(void)arg;
+	memset(&w, 0, sizeof(w));
+
+	while (1)
+	{
+		i = __atomic_fetch_add(&extractPool.next, 1, __ATOMIC_RELAXED);
+		if (i >= nbFileToDump)
+		{
+			break;
+		}
+		o     = &extractPool.outputs[i];
+		out   = open_memstream(&o->log, &o->logSize);
+		shell = open_memstream(&o->script, &o->scriptSize);
+		if ( (out == NULL) || (shell == NULL) )
+		{
+			printf("%s: Unable to open the log of %s\n", __FUNCTION__, fileToDumpList[i].node->name);
+			if (out != NULL)
+			{
+				fclose(out);
+			}
+			if (shell != NULL)
+			{
+				fclose(shell);
+			}
+			continue;
+		}
+		o->hash = extract_hash_new();
+		extract_file(extractPool.c, &w, fileToDumpList[i].node, out, shell, o->hash);
+		fclose(out);
+		fclose(shell);
+	}
+
+	free(w.data_node);
+	free(w.window.buf);
+	leb_aio_close(w.window.aio);
+	return NULL;
+}
+
+/**
+ * Extract the files of the list with extractThreads threads,
+ * then print the log of each file in the order of the list
+ */
+static void extract_files_threads(struct ubifs_info *c, FILE *shell)
+{
+	pthread_t *threads;
+	int nbThreads;
+	int i;
+
+	extractPool.c       = c;
+	extractPool.next    = 0;
+	extractPool.outputs = calloc(nbFileToDump, sizeof(*extractPool.outputs));
+	threads             = calloc(extractThreads, sizeof(*threads));
+	if ( (extractPool.outputs == NULL) || (threads == NULL) )
 	{
-		printf("Unable to open for write %s script\n", NANDUMP_FILENAME);
+		printf("%s: Out of memory\n", __FUNCTION__);
+		free(extractPool.outputs);
+		free(threads);
 		return;
 	}
 
-	/* For each file's to extract */
+	for (nbThreads=0; nbThreads<extractThreads; nbThreads++)
+	{
+		if (pthread_create(&threads[nbThreads], NULL, extract_thread, NULL))
+		{
+			printf("%s: Unable to create thread %d\n", __FUNCTION__, nbThreads);
+			break;
+		}
+	}
+	/* No thread: extract in this one */
+	if (nbThreads == 0)
+	{
+		extract_thread(NULL);
+	}
+	for (i=0; i<nbThreads; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
 	for (i=0; i<nbFileToDump; i++)
 	{
 		printf("\n");
-		extract_file(c, fileToDumpList[i].node);
+		if (extractPool.outputs[i].log != NULL)
+		{
+			fwrite(extractPool.outputs[i].log, 1, extractPool.outputs[i].logSize, stdout);
+		}
+		if ( (shell != NULL) && (extractPool.outputs[i].script != NULL) )
+		{
+			fwrite(extractPool.outputs[i].script, 1, extractPool.outputs[i].scriptSize, shell);
+		}
+		free(extractPool.outputs[i].log);
+		free(extractPool.outputs[i].script);
+		extract_digest(extractPool.outputs[i].hash, fileToDumpList[i].node);
 	}
 
-	if (fdShell != NULL)
+	free(extractPool.outputs);
+	extractPool.outputs = NULL;
+	free(threads);
+}
+
+/**
+ *
+ *
+ */
+static void extract_files_list(struct ubifs_info *c)
+{
+	struct extract_worker w;
+	struct file_hash *hash;
+	FILE *fdShell;
+	int i;
+
+	if (archive_is_enabled())
 	{
-		fprintf(fdShell, "md5sum /home/root/*.json /home/root/*Dmp | sort\n");
-		fclose(fdShell);
+		/* Streamed: nothing written on the target, no nanddump script */
 		fdShell = NULL;
+		file_hash_drop_default_manifest();
+	}
+	else
+	{
+		fdShell = fopen(NANDUMP_FILENAME, "w");
+		if (fdShell == NULL)
+		{
+			printf("Unable to open for write %s script\n", NANDUMP_FILENAME);
+			return;
+		}
 	}
 
+	if (archive_is_enabled())
+	{
+		memset(&w, 0, sizeof(w));
+
+		/* Streamed one by one in the archive */
+		for (i=0; i<nbFileToDump; i++)
+		{
+			printf("\n");
+			hash = extract_hash_new();
+			extract_file(c, &w, fileToDumpList[i].node, stdout, fdShell, hash);
+			extract_digest(hash, fileToDumpList[i].node);
+		}
+
+		free(w.data_node);
+		free(w.window.buf);
+		leb_aio_close(w.window.aio);
+	}
+	else if (extract_batch_is_enabled())
+	{
+		/* All the files at once, in the physical order of the nodes */
+		struct ubifs_dent_node *dents[NB_ELEM_OF(fileToDumpList)];
+		struct file_hash *hashes[NB_ELEM_OF(fileToDumpList)];
+
+		for (i=0; i<nbFileToDump; i++)
+		{
+			dents[i]  = fileToDumpList[i].node;
+			hashes[i] = extract_hash_new();
+		}
+		printf("\n");
+		extract_batch_run(c, dents, hashes, nbFileToDump, "/home/root");
+
+		for (i=0; i<nbFileToDump; i++)
+		{
+			extract_digest(hashes[i], fileToDumpList[i].node);
+		}
+	}
+	else if (extractThreads > 0)
+	{
+		/* Files extracted in parallel, logs printed in the list order */
+		extract_files_threads(c, fdShell);
+	}
+	else
+	{
+		memset(&w, 0, sizeof(w));
+
+		/* For each file's to extract */
+		for (i=0; i<nbFileToDump; i++)
+		{
+			printf("\n");
+			hash = extract_hash_new();
+			extract_file(c, &w, fileToDumpList[i].node, stdout, fdShell, hash);
+			extract_digest(hash, fileToDumpList[i].node);
+		}
+
+		free(w.data_node);
+		free(w.window.buf);
+		leb_aio_close(w.window.aio);
+	}
+
+	file_hash_manifest_close();
+	if (fdShell == NULL)
+	{
+		return;
+	}
+
+	fprintf(fdShell, "md5sum /home/root/*.json /home/root/*Dmp | sort\n");
+	fclose(fdShell);
+
 	printf(THE_SEPARATOR);
-	sprintf(command, "cat %s", NANDUMP_FILENAME);
-	printf("%s\n", command);
-	fflush(stdout);
-	system(command);
+	printf("%s:\n", NANDUMP_FILENAME);
+	extract_print_file(NANDUMP_FILENAME);
 }
 
 /**
@@ -526,6 +1117,30 @@ void ads_set_leb_to_dump(int leb)
 	lebToDump = leb;
 }
 
+/**
+ * Set the number of threads extracting the files, 0: the main thread only
+ */
+void ads_set_extract_threads(int nbThreads)
+{
+	extractThreads = nbThreads;
+}
+
+/**
+ * Set the MTD device containing the UBI volume
+ */
+void ads_set_mtd_device(const char *device)
+{
+	mtdDevice = device;
+}
+
+/**
+ * Return the MTD device containing the UBI volume
+ */
+const char *ads_get_mtd_device(void)
+{
+	return mtdDevice;
+}
+
 /**
  * Main function
  */
@@ -543,8 +1158,9 @@ void ads_dump( struct ubifs_info *c)
         printf(THE_SEPARATOR);
         fflush(stdout);
 
-	/* Look up LEB<->PEB association */
-	err = peb_leb_init(MTD_DEVICE);
+	/* Look up LEB<->PEB association, only for the opened UBI volume */
+	peb_leb_set_vol_id(c->vi.vol_id);
+	err = peb_leb_init(mtdDevice);
 	if (err)
 	{
 		printf("Error peb_leb_init return:%d\n", err);
@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <getopt.h>
 #include <signal.h>
+#include <sys/uio.h>
 
 #include "bitops.h"
 #include "kmem.h"
@@ -25,16 +26,241 @@
 
 
 /* ads_dump.c */
+/* Metadata of an inode */
+struct ads_ino_info
+{
+	uint64_t size;
+	unsigned int mode;
+	unsigned int uid;
+	unsigned int gid;
+	unsigned int nlink;
+	uint64_t mtime;
+};
 uint64_t ads_print_ino_node(struct ubifs_info *c, uint64_t inode);
+uint64_t ads_fprint_ino_node(FILE *out, struct ubifs_info *c, uint64_t inode);
+uint64_t ads_fprint_hole(FILE *out, const char *name, unsigned int first, unsigned int count, uint64_t fileSize);
+int      ads_get_ino_info(struct ubifs_info *c, uint64_t inode, struct ads_ino_info *info);
 void     ads_set_leb_to_dump(int leb);
+void     ads_set_extract_threads(int nbThreads);
+void     ads_set_mtd_device(const char *device);
+const char *ads_get_mtd_device(void);
 void     ads_dump(struct ubifs_info *c);
 
 
+/* ads_tnc.c */
+/* Iterator on the data nodes of an inode */
+struct ads_tnc_iter
+{
+	struct ubifs_info *c;
+	uint64_t inum;
+
+	/* Next block to return and end of the file */
+	unsigned int block;
+	unsigned int endBlock;
+
+	/* Current branch of level 0, znode NULL: no more node */
+	struct ubifs_znode *znode;
+	int n;
+
+	int done;
+};
+/* A data node (count 1, lnum >= 0) or a hole (lnum -1) */
+struct ads_tnc_extent
+{
+	unsigned int block;
+	unsigned int count;
+	int lnum;
+	int offs;
+	int len;
+};
+int ads_tnc_iter_init(struct ubifs_info *c, struct ads_tnc_iter *it, uint64_t inum,
+		      unsigned int firstBlock, unsigned int endBlock);
+int ads_tnc_iter_next(struct ads_tnc_iter *it, struct ads_tnc_extent *ext);
+int ads_tnc_read_node(struct ubifs_info *c, const union ubifs_key *key, void *buf,
+		      const void **node, int *lnum, int *offs);
+
+
+/* archive.c */
+int   archive_set_format(const char *name);
+int   archive_is_enabled(void);
+int   archive_open(void); /* Call before the first message */
+FILE *archive_stream(void);
+int   archive_file_begin(const char *name, const struct ads_ino_info *info);
+void  archive_file_end(const struct ads_ino_info *info);
+void  archive_close(void);
+
+
+/* hash.c */
+struct file_hash;
+int  file_hash_set_algos(const char *list);
+void file_hash_set_manifest(const char *file);
+void file_hash_drop_default_manifest(void);
+int  file_hash_is_enabled(void);
+struct file_hash *file_hash_new(void);
+void file_hash_free(struct file_hash *hs);
+void file_hash_update(struct file_hash *hs, const void *data, size_t len);
+void file_hash_final(struct file_hash *hs);
+void file_hash_print(FILE *out, const struct file_hash *hs, const char *path);
+void file_hash_manifest_add(const struct file_hash *hs, const char *path);
+void file_hash_manifest_close(void);
+
+
+/* decomp.c */
+struct decomp_pipe;
+void decomp_set_threads(int nbThreads);
+int  decomp_data_node(const struct ubifs_data_node *dn, int nodeLen, void *block);
+struct decomp_pipe *decomp_pipe_open(FILE *fd, FILE *log, struct file_hash *hash, int sparse);
+void decomp_pipe_push(struct decomp_pipe *p, const struct ubifs_data_node *dn,
+		      int nodeLen, int writeLen);
+int  decomp_pipe_close(struct decomp_pipe *p);
+
+
+/* extract_batch.c */
+void extract_batch_set_enabled(int enable);
+int  extract_batch_is_enabled(void);
+void extract_batch_run(struct ubifs_info *c, struct ubifs_dent_node **dents,
+		       struct file_hash **hashes, int nbFiles, const char *outDir);
+
+
 /* peb_leb.c */
 int peb_leb_init(const char *mtd_device); /* Call first */
+int peb_leb_init_image(const char *image, int ebSize, int minIoSize); /* Or this one */
+int peb_leb_init_raw(const char *mtd_device);                       /* Or this one */
+void peb_leb_close(void);
+void peb_leb_set_threads(int nbThread);   /* Call before peb_leb_init */
+void peb_leb_set_hdr_crc_check(int enable); /* Call before peb_leb_init */
+void peb_leb_set_vol_id(int volId);       /* Call before peb_leb_init */
+void peb_leb_set_cache_file(const char *fileName); /* Call before peb_leb_init */
 int peb_leb_getPeb(int leb);
+int peb_leb_getPeb2(int leb);
+int peb_leb_getPebs(const int *lebs, int *pebs, int nb);
 int peb_leb_getDataOffset(int peb);
 int peb_leb_get_eb_size(void);
+int peb_leb_get_leb_size(void);
+int peb_leb_get_min_io_size(void);
+int peb_leb_get_vol_info(int volId, int *rsvdLebs, char *name);
+int peb_leb_is_raw(void);
+int peb_leb_is_image(void);
+int peb_leb_is_mapped(int lnum);
+int peb_leb_is_bad_peb(int peb);
+long long peb_leb_get_ec(int peb);
+void peb_leb_print_wear(void);
+int peb_leb_read_leb(int lnum, void *buf, int offs, int len);
+const void *peb_leb_map_leb(int lnum, int offs, int len);
+
+/* io_ebadmsg_ro.c */
+/* Read context of one thread (ubifs_leb_read_r) */
+struct ubifs_read_ctx
+{
+	/* Device read, shared between threads (positional read) */
+	int fd;
+
+	/* Statistics of the thread */
+	unsigned long long reads;
+	unsigned long long bytes;
+	unsigned long long errors;
+
+	/* Last error and its position */
+	int last_err;
+	int last_lnum;
+	int last_offs;
+};
+void ubifs_read_ctx_init(const struct ubifs_info *c, struct ubifs_read_ctx *ctx);
+int  ubifs_leb_read_r(const struct ubifs_info *c, struct ubifs_read_ctx *ctx,
+		      int lnum, void *buf, int offs, int len, int even_ebadmsg);
+const void *ubifs_map_node(const struct ubifs_info *c, int type, int len,
+			   int lnum, int offs);
+
+/* leb_cache.c */
+typedef int (*leb_cache_reader)(const struct ubifs_info *c, struct ubifs_read_ctx *ctx,
+				int lnum, void *buf, int offs, int len);
+void leb_cache_set_size(long long size); /* Call before the first read */
+int  leb_cache_is_enabled(void);
+int  leb_cache_read(const struct ubifs_info *c, struct ubifs_read_ctx *ctx,
+		    int lnum, void *buf, int offs, int len, leb_cache_reader reader);
+void leb_cache_get_stats(unsigned long long *hit, unsigned long long *miss);
+void leb_cache_print_stats(void);
+void leb_cache_free(void);
+
+/* bad_pages.c */
+void bad_pages_set_retry(int retry); /* Call before the first read */
+int  bad_pages_is_bad(int lnum, int offs, int len);
+int  bad_pages_has_bad(int lnum, int offs, int len);
+int  bad_pages_has_failed(int lnum, int offs, int len);
+void bad_pages_record(const struct ubifs_info *c, struct ubifs_read_ctx *ctx,
+		      int lnum, int offs, int len, int err, leb_cache_reader reader);
+void bad_pages_print(void);
+
+/* io_stats.c */
+enum io_stats_op
+{
+	IO_STATS_LEB_READ,
+	IO_STATS_READ_NODE,
+	IO_STATS_CHECK_NODE,
+	IO_STATS_OPS
+};
+void io_stats_set(int enable, const char *file); /* Call before the first read */
+unsigned long long io_stats_begin(void);
+void io_stats_end(enum io_stats_op op, unsigned long long start, int lnum, int len, int err);
+void io_stats_print(void);
+
+/* read_plan.c */
+/* One read of a batch */
+struct read_plan_req
+{
+	int   lnum;
+	int   offs;
+	int   len;
+	void *buf;
+
+	/* Result, like ubifs_leb_read */
+	int   err;
+};
+struct leb_aio;
+int  read_plan_execute(const struct ubifs_info *c, struct leb_aio *aio,
+		       struct read_plan_req *reqs, int nb);
+void read_plan_print_stats(void);
+
+/* leb_aio.c */
+/* One asynchronous LEB read */
+struct leb_aio_req
+{
+	int   lnum;
+	int   offs;
+	int   len;
+	void *buf;
+
+	/* Result, like ubifs_leb_read (-EBADMSG: buf filled with 0xFF) */
+	int   err;
+
+	/* Free for the caller */
+	void *priv;
+
+	/* Internal */
+	struct iovec iov;
+	unsigned long long start;
+};
+struct leb_aio;
+void leb_aio_set_enabled(int enable); /* Call before leb_aio_open */
+struct leb_aio *leb_aio_open(const struct ubifs_info *c, unsigned depth);
+int  leb_aio_is_async(const struct leb_aio *aio);
+unsigned leb_aio_pending(const struct leb_aio *aio);
+int  leb_aio_submit(struct leb_aio *aio, struct leb_aio_req *req);
+int  leb_aio_complete(struct leb_aio *aio, struct leb_aio_req **req);
+void leb_aio_close(struct leb_aio *aio);
+
+/* crc32_fast.c */
+uint32_t crc32_fast(uint32_t crc, const void *buf, int len);
+const char *crc32_fast_name(void);
+
+/* raw_vol.c */
+void raw_vol_set_image(const char *image);
+void raw_vol_set_raw_mtd(int enable);
+void raw_vol_set_geometry(int ebSize, int minIoSize);
+void raw_vol_set_vol_id(int volId);
+int  raw_vol_is_enabled(void);
+int  raw_vol_open(struct ubifs_info *c);
+void raw_vol_close(struct ubifs_info *c);
 
 /* dump_fs.c */
 void dump_fs_from_root(struct ubifs_info *c);
@@ -0,0 +1,301 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * This file is part of UBIFS.
+ *
+ * Copyright (C) 2025 AIRBUS Defence & Space
+ *
+ * Authors: Frederic Fraysse
+ */
+
+/*
+ * Iterator on the data nodes of an inode.
+ * The data keys of an inode follow each other in the level 0 of the TNC:
+ * the tree is descended once, then the next keys are reached by moving
+ * to the next branch (and to the next znode through the parents), instead
+ * of descending the tree from the root for each block.
+ * Also a single pass lookup of a node returning the node and its location.
+ */
+
+#include "linux_err.h"
+
+#include "ads_dump.h"
+
+
+/**
+ * Return the child n of znode, loaded from the flash if not in memory
+ */
+static struct ubifs_znode *ads_tnc_get_znode(
+		struct ubifs_info *c,
+		struct ubifs_znode *znode,
+		int n)
+{
+	struct ubifs_zbranch *zbr = &znode->zbranch[n];
+
+	if (zbr->znode != NULL)
+	{
+		return zbr->znode;
+	}
+	return ubifs_load_znode(c, zbr, znode, n);
+}
+
+/**
+ * Move to the next branch of level 0
+ * Return 0, -ENOENT at the end of the index, or an error
+ */
+static int ads_tnc_next(struct ubifs_info *c, struct ubifs_znode **zn, int *n)
+{
+	struct ubifs_znode *znode = *zn;
+	int nn = *n + 1;
+
+	if (nn < znode->child_cnt)
+	{
+		*n = nn;
+		return 0;
+	}
+
+	/* Go up until a znode with a next branch, then down to level 0 */
+	while (1)
+	{
+		if (znode->parent == NULL)
+		{
+			return -ENOENT;
+		}
+		nn     = znode->iip + 1;
+		znode  = znode->parent;
+		if (nn < znode->child_cnt)
+		{
+			break;
+		}
+	}
+
+	znode = ads_tnc_get_znode(c, znode, nn);
+	while (!IS_ERR(znode) && (znode->level != 0))
+	{
+		znode = ads_tnc_get_znode(c, znode, 0);
+	}
+	if (IS_ERR(znode))
+	{
+		return PTR_ERR(znode);
+	}
+
+	*zn = znode;
+	*n  = 0;
+	return 0;
+}
+
+/**
+ * Start an iteration on the data blocks [firstBlock, endBlock) of an inode
+ * endBlock: number of blocks of the file, the blocks after the last node
+ * are returned as a hole
+ * Return 0 or an error of the TNC
+ */
+int ads_tnc_iter_init(
+		struct ubifs_info *c,
+		struct ads_tnc_iter *it,
+		uint64_t inum,
+		unsigned int firstBlock,
+		unsigned int endBlock)
+{
+	union ubifs_key key;
+	int found;
+
+	memset(it, 0, sizeof(*it));
+	it->c        = c;
+	it->inum     = inum;
+	it->block    = firstBlock;
+	it->endBlock = endBlock;
+
+	if (firstBlock >= endBlock)
+	{
+		it->done = 1;
+		return 0;
+	}
+
+	data_key_init(c, &key, inum, firstBlock);
+
+	mutex_lock(&c->tnc_mutex);
+	found = ubifs_lookup_level0(c, &key, &it->znode, &it->n);
+	if (found < 0)
+	{
+		mutex_unlock(&c->tnc_mutex);
+		it->done = 1;
+		return found;
+	}
+	/* Not found: n is the branch before the key (may be -1) */
+	if (!found)
+	{
+		found = ads_tnc_next(c, &it->znode, &it->n);
+		if (found == -ENOENT)
+		{
+			it->znode = NULL;
+		}
+		else if (found)
+		{
+			mutex_unlock(&c->tnc_mutex);
+			it->done = 1;
+			return found;
+		}
+	}
+	mutex_unlock(&c->tnc_mutex);
+	return 0;
+}
+
+/**
+ * Return the next extent of the file: a data node (count 1, lnum >= 0)
+ * or a hole (count >= 1, lnum -1)
+ * Return 1 with an extent, 0 at the end, or an error of the TNC
+ */
+int ads_tnc_iter_next(struct ads_tnc_iter *it, struct ads_tnc_extent *ext)
+{
+	struct ubifs_info    *c = it->c;
+	struct ubifs_zbranch *zbr;
+	unsigned int block;
+	int err;
+
+	if (it->done)
+	{
+		return 0;
+	}
+
+	mutex_lock(&c->tnc_mutex);
+
+	/* Skip the keys before the current block */
+	block = it->endBlock;
+	while (it->znode != NULL)
+	{
+		zbr = &it->znode->zbranch[it->n];
+		if ( (key_inum(c, &zbr->key) != it->inum) ||
+		     (key_type(c, &zbr->key) != UBIFS_DATA_KEY) )
+		{
+			/* No more data key of this inode */
+			it->znode = NULL;
+			break;
+		}
+		block = key_block(c, &zbr->key);
+		if (block >= it->block)
+		{
+			break;
+		}
+		err = ads_tnc_next(c, &it->znode, &it->n);
+		if (err == -ENOENT)
+		{
+			it->znode = NULL;
+		}
+		else if (err)
+		{
+			mutex_unlock(&c->tnc_mutex);
+			it->done = 1;
+			return err;
+		}
+	}
+	if ( (it->znode == NULL) || (block > it->endBlock) )
+	{
+		block = it->endBlock;
+	}
+
+	/* Hole until the next data node (or the end of the file) */
+	if (block > it->block)
+	{
+		ext->block = it->block;
+		ext->count = block - it->block;
+		ext->lnum  = -1;
+		ext->offs  = 0;
+		ext->len   = 0;
+		it->block  = block;
+	}
+	else if (it->znode != NULL)
+	{
+		zbr = &it->znode->zbranch[it->n];
+		ext->block = block;
+		ext->count = 1;
+		ext->lnum  = zbr->lnum;
+		ext->offs  = zbr->offs;
+		ext->len   = zbr->len;
+		it->block  = block + 1;
+	}
+	else
+	{
+		mutex_unlock(&c->tnc_mutex);
+		it->done = 1;
+		return 0;
+	}
+
+	if (it->block >= it->endBlock)
+	{
+		it->done = 1;
+	}
+	mutex_unlock(&c->tnc_mutex);
+	return 1;
+}
+
+/**
+ * Locate and read a node: one descent of the TNC and one read, instead of
+ * ubifs_tnc_lookup followed by ubifs_tnc_locate
+ * In a mapped image, the data and inode nodes are accessed without copy
+ * (the CRC and the key of the node are checked)
+ *
+ * buf: buffer for the node (size of the node max), if not accessed in place
+ * node: the read only node, in buf or in the image
+ * lnum, offs: location of the node in the volume
+ * Return 0, -ENOENT if the key is not in the TNC, or an error
+ */
+int ads_tnc_read_node(
+		struct ubifs_info *c,
+		const union ubifs_key *key,
+		void *buf,
+		const void **node,
+		int *lnum,
+		int *offs)
+{
+	struct ubifs_znode   *znode;
+	struct ubifs_zbranch *zbr;
+	union ubifs_key nodeKey;
+	const void *mapped = NULL;
+	int type;
+	int found;
+	int n;
+
+	/* Hashed keys (entries) may collide: left to ubifs_tnc_locate */
+	type = key_type(c, key);
+	if ( peb_leb_is_image() &&
+	     ((type == UBIFS_DATA_KEY) || (type == UBIFS_INO_KEY)) )
+	{
+		mutex_lock(&c->tnc_mutex);
+		found = ubifs_lookup_level0(c, key, &znode, &n);
+		if (found <= 0)
+		{
+			mutex_unlock(&c->tnc_mutex);
+			return (found == 0) ? -ENOENT : found;
+		}
+		zbr    = &znode->zbranch[n];
+		mapped = ubifs_map_node(c,
+					(type == UBIFS_DATA_KEY) ? UBIFS_DATA_NODE : UBIFS_INO_NODE,
+					zbr->len, zbr->lnum, zbr->offs);
+		if (mapped != NULL)
+		{
+			/* Node of another key (stale LEB): ubifs_tnc_locate reports it
+			 * (key at the same place in the data and inode nodes) */
+			key_read(c, &((const struct ubifs_data_node *)mapped)->key, &nodeKey);
+			if (keys_cmp(c, &zbr->key, &nodeKey) != 0)
+			{
+				mapped = NULL;
+			}
+		}
+		if (mapped != NULL)
+		{
+			(*lnum) = zbr->lnum;
+			(*offs) = zbr->offs;
+		}
+		mutex_unlock(&c->tnc_mutex);
+
+		if (mapped != NULL)
+		{
+			(*node) = mapped;
+			return 0;
+		}
+	}
+
+	/* Read in buf, with the checks of the node (and its location) */
+	(*node) = buf;
+	return ubifs_tnc_locate(c, key, buf, lnum, offs);
+}
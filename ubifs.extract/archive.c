@@ -0,0 +1,274 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * This file is part of UBIFS.
+ *
+ * Copyright (C) 2025 AIRBUS Defence & Space
+ *
+ * Authors: Frederic Fraysse
+ */
+
+/*
+ * Extracted files streamed as a tar (ustar) or cpio (newc) archive on the
+ * standard output, to a pipe, ssh or a compressor: no file written on the
+ * target, no second read.
+ * The archive takes the standard output: the messages of the program are
+ * sent to the standard error.
+ */
+
+#include "ads_dump.h"
+
+#include <unistd.h>
+
+
+/* Size of a tar block */
+#define TAR_BLOCK (512)
+
+/* Archive formats */
+enum archive_format
+{
+	ARCHIVE_NONE,
+	ARCHIVE_TAR,
+	ARCHIVE_CPIO,
+};
+
+static enum archive_format archiveFormat = ARCHIVE_NONE;
+
+/* The archive stream (the standard output at start) */
+static FILE *archiveStream = NULL;
+
+/* Number of files in the archive, and inode numbers of cpio */
+static unsigned int archiveFiles = 0;
+
+
+/**
+ * Select the archive format: "tar" or "cpio"
+ * Return 0 or -1 if the format is unknown
+ */
+int archive_set_format(const char *name)
+{
+	if (strcmp(name, "tar") == 0)
+	{
+		archiveFormat = ARCHIVE_TAR;
+	}
+	else if (strcmp(name, "cpio") == 0)
+	{
+		archiveFormat = ARCHIVE_CPIO;
+	}
+	else
+	{
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Return 1 if the files are streamed as an archive
+ */
+int archive_is_enabled(void)
+{
+	return archiveFormat != ARCHIVE_NONE;
+}
+
+/**
+ * Take the standard output for the archive, the messages go to the
+ * standard error. Call before the first message.
+ * Return 0 or -errno
+ */
+int archive_open(void)
+{
+	int fd;
+
+	fflush(stdout);
+	fd = dup(STDOUT_FILENO);
+	if (fd < 0)
+	{
+		return -errno;
+	}
+	archiveStream = fdopen(fd, "w");
+	if (archiveStream == NULL)
+	{
+		close(fd);
+		return -errno;
+	}
+	if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+	{
+		fclose(archiveStream);
+		archiveStream = NULL;
+		return -errno;
+	}
+	return 0;
+}
+
+/**
+ * Return the stream to write the data of the files
+ */
+FILE *archive_stream(void)
+{
+	return archiveStream;
+}
+
+/**
+ * Write padding bytes (zero)
+ */
+static void archive_pad(int len)
+{
+	static const uint8_t zero[TAR_BLOCK];
+
+	if (len > 0)
+	{
+		fwrite(zero, len, 1, archiveStream);
+	}
+}
+
+/**
+ * Octal field of a tar header, base-256 if too large (GNU tar extension)
+ */
+static void archive_tar_number(char *field, int len, uint64_t value)
+{
+	int i;
+
+	if ( (len * 3 - 3 >= 64) || (value < (1ULL << (len * 3 - 3))) )
+	{
+		snprintf(field, len, "%0*llo", len - 1, (unsigned long long)value);
+		return;
+	}
+	memset(field, 0, len);
+	field[0] = (char)0x80;
+	for (i = len - 1; (i > 0) && value; i--)
+	{
+		field[i] = value & 0xFF;
+		value  >>= 8;
+	}
+}
+
+/**
+ * Write a ustar header
+ */
+static int archive_tar_header(const char *name, const struct ads_ino_info *info)
+{
+	char hdr[TAR_BLOCK];
+	unsigned int sum = 0;
+	size_t nameLen = strlen(name);
+	int i;
+
+	if (nameLen > 100)
+	{
+		printf("%s: Name too long for tar: %s\n", __FUNCTION__, name);
+		return -ENAMETOOLONG;
+	}
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, name, nameLen);
+	archive_tar_number(hdr + 100, 8,  info->mode & 07777);
+	archive_tar_number(hdr + 108, 8,  info->uid);
+	archive_tar_number(hdr + 116, 8,  info->gid);
+	archive_tar_number(hdr + 124, 12, info->size);
+	archive_tar_number(hdr + 136, 12, info->mtime);
+	hdr[156] = '0';
+	memcpy(hdr + 257, "ustar", 6);
+	memcpy(hdr + 263, "00", 2);
+
+	/* Checksum computed with the field filled of spaces */
+	memset(hdr + 148, ' ', 8);
+	for (i=0; i<TAR_BLOCK; i++)
+	{
+		sum += (uint8_t)hdr[i];
+	}
+	snprintf(hdr + 148, 8, "%06o", sum);
+
+	return (1 == fwrite(hdr, sizeof(hdr), 1, archiveStream)) ? 0 : -EIO;
+}
+
+/**
+ * Write a cpio newc header, and its name
+ */
+static int archive_cpio_header(const char *name, unsigned int ino, const struct ads_ino_info *info)
+{
+	size_t nameLen = strlen(name) + 1;
+
+	if (info->size > 0xFFFFFFFFULL)
+	{
+		printf("%s: File too large for cpio: %s\n", __FUNCTION__, name);
+		return -EFBIG;
+	}
+
+	fprintf(archiveStream,
+			"070701%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X",
+			ino,
+			info->mode,
+			info->uid,
+			info->gid,
+			info->nlink,
+			(unsigned int)info->mtime,
+			(unsigned int)info->size,
+			0, 0, 0, 0,
+			(unsigned int)nameLen,
+			0);
+	fwrite(name, nameLen, 1, archiveStream);
+
+	/* Header (110 bytes) and name padded to 4 bytes */
+	archive_pad((4 - ((110 + nameLen) & 3)) & 3);
+	return ferror(archiveStream) ? -EIO : 0;
+}
+
+/**
+ * Start a file of the archive, its info->size bytes of data are then
+ * written to archive_stream()
+ * Return 0 or an error (the file can't be in the archive)
+ */
+int archive_file_begin(const char *name, const struct ads_ino_info *info)
+{
+	archiveFiles++;
+	if (archiveFormat == ARCHIVE_TAR)
+	{
+		return archive_tar_header(name, info);
+	}
+	return archive_cpio_header(name, archiveFiles, info);
+}
+
+/**
+ * End a file of the archive: padding of its data
+ */
+void archive_file_end(const struct ads_ino_info *info)
+{
+	if (archiveFormat == ARCHIVE_TAR)
+	{
+		archive_pad((TAR_BLOCK - (info->size % TAR_BLOCK)) % TAR_BLOCK);
+	}
+	else
+	{
+		archive_pad((4 - (info->size & 3)) & 3);
+	}
+}
+
+/**
+ * Write the end of the archive, and close it
+ */
+void archive_close(void)
+{
+	struct ads_ino_info trailer;
+
+	if (archiveStream == NULL)
+	{
+		return;
+	}
+
+	if (archiveFormat == ARCHIVE_TAR)
+	{
+		archive_pad(TAR_BLOCK);
+		archive_pad(TAR_BLOCK);
+	}
+	else
+	{
+		memset(&trailer, 0, sizeof(trailer));
+		trailer.nlink = 1;
+		archive_cpio_header("TRAILER!!!", 0, &trailer);
+	}
+
+	if (fclose(archiveStream))
+	{
+		printf("%s: Unable to write the archive\n", __FUNCTION__);
+	}
+	archiveStream = NULL;
+	printf("Archive: %u files\n", archiveFiles);
+}
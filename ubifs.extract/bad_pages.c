@@ -0,0 +1,333 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * This file is part of UBIFS.
+ *
+ * Copyright (C) 2025 AIRBUS Defence & Space
+ *
+ * Authors: Frederic Fraysse
+ */
+
+/*
+ * Map of the flash pages (min_io_size) which can't be read (ECC error).
+ * On a degraded chip the TNC walk reads the same bad pages again and again,
+ * each read waiting for the timeout of the MTD driver: once a page failed
+ * more than the retry count, the reads containing it fail at once.
+ * At exit the map is printed with the LEB and PEB coordinates.
+ */
+
+#include "ads_dump.h"
+
+#include <pthread.h>
+
+
+/* Number of lists of the hash table */
+#define BAD_PAGES_HASH (1024)
+
+/* Default number of read retries of a failed page before failing at once */
+#define BAD_PAGES_RETRY_DEFAULT (1)
+
+/* One page with read errors */
+struct bad_page
+{
+	int lnum;
+	/* Index of the page in the LEB */
+	int page;
+
+	/* Number of failed reads, and of reads failed without reading */
+	int failures;
+	int fastFails;
+
+	/* Last error of the device */
+	int lastErr;
+
+	struct bad_page *next;
+};
+
+/* Number of retries of a failed page, -1: no map */
+static int retryCount = BAD_PAGES_RETRY_DEFAULT;
+
+/* Size of a page, set at the first failure */
+static int pageSize = 0;
+
+static struct bad_page *hashTable[BAD_PAGES_HASH];
+
+/* Number of pages in the map */
+static int nbBadPages = 0;
+
+static pthread_mutex_t badLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * Set the number of reads retried on a failed page
+ * before failing without reading, -1: never fail without reading
+ */
+void bad_pages_set_retry(int retry)
+{
+	retryCount = retry;
+}
+
+static inline int bad_pages_hash(int lnum, int page)
+{
+	return ((unsigned int)lnum * 31 + (unsigned int)page) % BAD_PAGES_HASH;
+}
+
+/**
+ * Find a page, called with the lock held
+ */
+static struct bad_page *bad_pages_find(int lnum, int page)
+{
+	struct bad_page *p;
+
+	for (p = hashTable[bad_pages_hash(lnum, page)]; p != NULL; p = p->next)
+	{
+		if ( (p->lnum == lnum) && (p->page == page) )
+		{
+			return p;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Return 1 if the range contains a page failed at least minFailures times
+ * count: count the read skipped (0: only a check before the read)
+ */
+static int bad_pages_lookup(int lnum, int offs, int len, int minFailures, int count)
+{
+	struct bad_page *p;
+	int page, last;
+	int bad = 0;
+
+	/* Fast path: nothing failed */
+	if ( (retryCount < 0) || (__atomic_load_n(&nbBadPages, __ATOMIC_RELAXED) == 0) || (len <= 0) )
+	{
+		return 0;
+	}
+
+	pthread_mutex_lock(&badLock);
+	last = (offs + len - 1) / pageSize;
+	for (page = offs / pageSize; page <= last; page++)
+	{
+		p = bad_pages_find(lnum, page);
+		if ( (p != NULL) && (p->failures >= minFailures) )
+		{
+			p->fastFails += count;
+			bad = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&badLock);
+	return bad;
+}
+
+/**
+ * Return 1 if the read of the range must fail without reading the device
+ */
+int bad_pages_is_bad(int lnum, int offs, int len)
+{
+	return bad_pages_lookup(lnum, offs, len, retryCount + 1, 1);
+}
+
+/**
+ * Same as bad_pages_is_bad, without counting a read skipped: to choose the
+ * way to read before calling ubifs_leb_read_r
+ */
+int bad_pages_has_bad(int lnum, int offs, int len)
+{
+	return bad_pages_lookup(lnum, offs, len, retryCount + 1, 0);
+}
+
+/**
+ * Return 1 if the range contains a page which failed at least once, even
+ * if it may still be retried: to avoid reading it for another range
+ */
+int bad_pages_has_failed(int lnum, int offs, int len)
+{
+	return bad_pages_lookup(lnum, offs, len, 1, 0);
+}
+
+/**
+ * Count a failure of a page, called with the lock held
+ */
+static void bad_pages_add(int lnum, int page, int err)
+{
+	struct bad_page *p;
+	int h;
+
+	p = bad_pages_find(lnum, page);
+	if (p == NULL)
+	{
+		p = calloc(1, sizeof(*p));
+		if (p == NULL)
+		{
+			return;
+		}
+		p->lnum  = lnum;
+		p->page  = page;
+		h = bad_pages_hash(lnum, page);
+		p->next = hashTable[h];
+		hashTable[h] = p;
+		__atomic_add_fetch(&nbBadPages, 1, __ATOMIC_RELAXED);
+	}
+	p->failures++;
+	p->lastErr = err;
+}
+
+/**
+ * Record a failed read of a range
+ * If the range has several pages, each one is read again alone to find
+ * the bad ones (reader: read of the device, as for the LEB cache)
+ */
+void bad_pages_record(const struct ubifs_info *c, struct ubifs_read_ctx *ctx,
+		      int lnum, int offs, int len, int err, leb_cache_reader reader)
+{
+	uint8_t *buf;
+	int page, first, last;
+	int pageErr;
+	int found = 0;
+
+	if (retryCount < 0)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&badLock);
+	if (pageSize == 0)
+	{
+		pageSize = (c->min_io_size > 0) ? c->min_io_size : 1;
+	}
+	pthread_mutex_unlock(&badLock);
+
+	first = offs / pageSize;
+	last  = (offs + len - 1) / pageSize;
+
+	/* Range with already known bad pages: the failure is theirs */
+	pthread_mutex_lock(&badLock);
+	for (page = first; page <= last; page++)
+	{
+		if (bad_pages_find(lnum, page) != NULL)
+		{
+			bad_pages_add(lnum, page, err);
+			found = 1;
+		}
+	}
+	pthread_mutex_unlock(&badLock);
+	if (found)
+	{
+		return;
+	}
+
+	/* Only one page: it's the bad one */
+	if (first == last)
+	{
+		pthread_mutex_lock(&badLock);
+		bad_pages_add(lnum, first, err);
+		pthread_mutex_unlock(&badLock);
+		return;
+	}
+
+	buf = malloc(pageSize);
+	for (page = first; (buf != NULL) && (page <= last); page++)
+	{
+		pageErr = reader(c, ctx, lnum, buf, page * pageSize,
+				 ((page + 1) * pageSize <= c->leb_size) ? pageSize : (c->leb_size - page * pageSize));
+		if (pageErr)
+		{
+			pthread_mutex_lock(&badLock);
+			bad_pages_add(lnum, page, pageErr);
+			pthread_mutex_unlock(&badLock);
+			found = 1;
+		}
+	}
+	free(buf);
+
+	/* The pages read alone are good (or no memory): record the whole range */
+	if (!found)
+	{
+		pthread_mutex_lock(&badLock);
+		for (page = first; page <= last; page++)
+		{
+			bad_pages_add(lnum, page, err);
+		}
+		pthread_mutex_unlock(&badLock);
+	}
+}
+
+/**
+ * qsort of the report, by LEB then page
+ */
+static int bad_pages_cmp(const void *a, const void *b)
+{
+	const struct bad_page *pa = *(const struct bad_page * const *)a;
+	const struct bad_page *pb = *(const struct bad_page * const *)b;
+
+	if (pa->lnum != pb->lnum)
+	{
+		return (pa->lnum < pb->lnum) ? -1 : 1;
+	}
+	return (pa->page < pb->page) ? -1 : (pa->page > pb->page);
+}
+
+/**
+ * Print the unreadable pages with their LEB and PEB coordinates
+ */
+void bad_pages_print(void)
+{
+	struct bad_page **sorted;
+	struct bad_page *p;
+	int i, n = 0;
+	int peb;
+	int lebOffs;
+
+	pthread_mutex_lock(&badLock);
+	if (nbBadPages == 0)
+	{
+		pthread_mutex_unlock(&badLock);
+		return;
+	}
+
+	sorted = malloc(nbBadPages * sizeof(*sorted));
+	if (sorted == NULL)
+	{
+		pthread_mutex_unlock(&badLock);
+		return;
+	}
+	for (i=0; i<BAD_PAGES_HASH; i++)
+	{
+		for (p = hashTable[i]; p != NULL; p = p->next)
+		{
+			sorted[n++] = p;
+		}
+	}
+	qsort(sorted, n, sizeof(*sorted), bad_pages_cmp);
+
+	printf("Unreadable pages: %d (page size %d, retry %d)\n", n, pageSize, retryCount);
+	for (i=0; i<n; i++)
+	{
+		p       = sorted[i];
+		lebOffs = p->page * pageSize;
+		peb     = peb_leb_getPeb(p->lnum);
+		if (peb >= 0)
+		{
+			printf("LEB %d:0x%X PEB %d:0x%X failures:%d fast-failed:%d err:%d\n",
+					p->lnum,
+					lebOffs,
+					peb,
+					peb_leb_getDataOffset(peb) + lebOffs,
+					p->failures,
+					p->fastFails,
+					p->lastErr);
+		}
+		else
+		{
+			printf("LEB %d:0x%X PEB unknown failures:%d fast-failed:%d err:%d\n",
+					p->lnum,
+					lebOffs,
+					p->failures,
+					p->fastFails,
+					p->lastErr);
+		}
+	}
+	free(sorted);
+	pthread_mutex_unlock(&badLock);
+}
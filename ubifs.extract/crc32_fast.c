@@ -0,0 +1,308 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * This file is part of UBIFS.
+ *
+ * Copyright (C) 2025 AIRBUS Defence & Space
+ *
+ * Authors: Frederic Fraysse
+ */
+
+/*
+ * CRC32 (polynomial 0xEDB88320, reflected) used by UBI and UBIFS headers.
+ * Same result as the crc32() of libcrc32: no inversion of the seed or of
+ * the result, the caller gives UBI_CRC32_INIT/UBIFS_CRC32_INIT.
+ *
+ * The implementation is selected at runtime:
+ *  - ARMv8 CRC32 instructions, if the CPU has them
+ *  - x86 carry-less multiply (PCLMULQDQ) folding, for buffers >= 64 bytes
+ *  - slice-by-8 tables otherwise
+ */
+
+#include "ads_dump.h"
+
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC32_FAST_X86
+#endif
+
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define CRC32_FAST_ARM64
+#endif
+
+
+/* Reflected polynomial */
+#define CRC32_POLY (0xEDB88320)
+
+/* Slice-by-8 tables, table[0] is the classic byte table */
+static uint32_t crcTable[8][256];
+
+/* Implementation selected by crc32_fast_init */
+static uint32_t (*crcImpl)(uint32_t crc, const uint8_t *buf, size_t len) = NULL;
+
+/* Name of the selected implementation */
+static const char *crcImplName = "none";
+
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+
+/**
+ * Slice-by-8: 8 bytes per iteration with 8 table lookups
+ */
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	uint32_t lo, hi;
+
+	/* Align the buffer on 8 bytes */
+	while ( (len > 0) && ((uintptr_t)buf & 7) )
+	{
+		crc = crcTable[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+		len--;
+	}
+
+	while (len >= 8)
+	{
+		lo = crc ^ ( (uint32_t)buf[0]        | ((uint32_t)buf[1] << 8) |
+			    ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24) );
+		hi =        (uint32_t)buf[4]        | ((uint32_t)buf[5] << 8) |
+			    ((uint32_t)buf[6] << 16) | ((uint32_t)buf[7] << 24);
+
+		crc = crcTable[7][ lo        & 0xFF] ^
+		      crcTable[6][(lo >> 8)  & 0xFF] ^
+		      crcTable[5][(lo >> 16) & 0xFF] ^
+		      crcTable[4][ lo >> 24        ] ^
+		      crcTable[3][ hi        & 0xFF] ^
+		      crcTable[2][(hi >> 8)  & 0xFF] ^
+		      crcTable[1][(hi >> 16) & 0xFF] ^
+		      crcTable[0][ hi >> 24        ];
+		buf += 8;
+		len -= 8;
+	}
+
+	while (len > 0)
+	{
+		crc = crcTable[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+		len--;
+	}
+	return crc;
+}
+
+#ifdef CRC32_FAST_ARM64
+/**
+ * ARMv8 CRC32 instructions (same polynomial, no inversion)
+ */
+__attribute__((target("+crc")))
+static uint32_t crc32_arm64(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	uint64_t data;
+
+	while ( (len > 0) && ((uintptr_t)buf & 7) )
+	{
+		crc = __crc32b(crc, *buf++);
+		len--;
+	}
+	while (len >= 8)
+	{
+		memcpy(&data, buf, sizeof(data));
+		crc  = __crc32d(crc, data);
+		buf += 8;
+		len -= 8;
+	}
+	while (len > 0)
+	{
+		crc = __crc32b(crc, *buf++);
+		len--;
+	}
+	return crc;
+}
+#endif
+
+#ifdef CRC32_FAST_X86
+/**
+ * Carry-less multiply folding (Intel white paper "Fast CRC Computation
+ * for Generic Polynomials Using PCLMULQDQ Instruction")
+ * 4 x 128 bits folded in parallel, then Barrett reduction
+ * Constants are for the reflected polynomial 0x104C11DB7
+ * The tail (< 16 bytes) is done by slice-by-8
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	static const uint64_t __attribute__((aligned(16))) k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+	static const uint64_t __attribute__((aligned(16))) k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+	static const uint64_t __attribute__((aligned(16))) k5k0[] = { 0x0163cd6124, 0x0000000000 };
+	static const uint64_t __attribute__((aligned(16))) poly[] = { 0x01db710641, 0x01f7011641 };
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	if (len < 64)
+	{
+		return crc32_slice8(crc, buf, len);
+	}
+
+	x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+
+	buf += 64;
+	len -= 64;
+
+	/* Fold 64 bytes per iteration */
+	while (len >= 64)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+		y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+		y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+		y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		buf += 64;
+		len -= 64;
+	}
+
+	/* Fold the 4 x 128 bits into 128 bits */
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* Fold 16 bytes per iteration */
+	while (len >= 16)
+	{
+		x2 = _mm_loadu_si128((const __m128i *)buf);
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		buf += 16;
+		len -= 16;
+	}
+
+	/* Fold 128 bits to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i *)poly);
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	crc = _mm_extract_epi32(x1, 1);
+
+	return crc32_slice8(crc, buf, len);
+}
+#endif
+
+/**
+ * Build the tables and select the implementation
+ */
+static void crc32_fast_init(void)
+{
+	uint32_t crc;
+	int i, j;
+
+	for (i=0; i<256; i++)
+	{
+		crc = i;
+		for (j=0; j<8; j++)
+		{
+			crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLY : 0);
+		}
+		crcTable[0][i] = crc;
+	}
+	for (i=0; i<256; i++)
+	{
+		for (j=1; j<8; j++)
+		{
+			crcTable[j][i] = crcTable[0][crcTable[j - 1][i] & 0xFF] ^ (crcTable[j - 1][i] >> 8);
+		}
+	}
+
+	crcImpl     = crc32_slice8;
+	crcImplName = "slice-by-8";
+
+#ifdef CRC32_FAST_ARM64
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+	{
+		crcImpl     = crc32_arm64;
+		crcImplName = "armv8-crc32";
+	}
+#endif
+#ifdef CRC32_FAST_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"))
+	{
+		crcImpl     = crc32_pclmul;
+		crcImplName = "x86-pclmul";
+	}
+#endif
+}
+
+/**
+ * Compute the CRC32, bit to bit identical to crc32() of libcrc32
+ * crc: seed (UBI_CRC32_INIT or UBIFS_CRC32_INIT)
+ */
+uint32_t crc32_fast(uint32_t crc, const void *buf, int len)
+{
+	pthread_once(&crcOnce, crc32_fast_init);
+
+	if (len <= 0)
+	{
+		return crc;
+	}
+	return crcImpl(crc, buf, len);
+}
+
+/**
+ * Return the name of the CRC32 implementation used
+ */
+const char *crc32_fast_name(void)
+{
+	pthread_once(&crcOnce, crc32_fast_init);
+
+	return crcImplName;
+}
@@ -0,0 +1,553 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * This file is part of UBIFS.
+ *
+ * Copyright (C) 2025 AIRBUS Defence & Space
+ *
+ * Authors: Frederic Fraysse
+ */
+
+/*
+ * Decompression of the data nodes (LZO, zlib, zstd) and pipeline
+ * extracting a file: the reader pushes the data nodes in a bounded queue,
+ * decompression threads expand them in UBIFS_BLOCK_SIZE buffers of the
+ * queue slots, and a writer thread writes the blocks in the file order.
+ * Without decompression thread the blocks are expanded and written at once
+ * by the reader.
+ * In a sparse pipeline the holes are not written: the writer seeks over
+ * them, and the size of a file ending with a hole is set at the close.
+ */
+
+#include "ads_dump.h"
+
+#include <pthread.h>
+#include <unistd.h>
+#include <lzo/lzo1x.h>
+#include <zlib.h>
+#include <zstd.h>
+
+
+/* Slots of the queue per decompression thread */
+#define DECOMP_SLOTS_PER_THREAD (4)
+
+/* State of a slot of the queue */
+enum decomp_slot_state
+{
+	DECOMP_FREE,
+	DECOMP_FILLED,
+	DECOMP_WORKING,
+	DECOMP_DONE,
+};
+
+/* A block of the file in the queue */
+struct decomp_slot
+{
+	enum decomp_slot_state state;
+
+	/* Data node, nodeLen 0: hole */
+	uint8_t *node;
+	int      nodeLen;
+
+	/* Bytes of the block to write */
+	int      writeLen;
+
+	/* Expanded block, zero padded */
+	uint8_t *block;
+	int      err;
+};
+
+/* Pipeline of one file */
+struct decomp_pipe
+{
+	FILE *fd;
+	FILE *log;
+
+	/* Digests of the written data, NULL if none */
+	struct file_hash *hash;
+
+	/* Holes skipped instead of written, and bytes to skip before the next write */
+	int      sparse;
+	uint64_t skip;
+
+	int nbThreads;
+	pthread_t *threads;
+	pthread_t  writer;
+	int        hasWriter;
+
+	struct decomp_slot *slots;
+	int nbSlots;
+
+	/* Sequence numbers of the next block to push, to expand, to write */
+	unsigned long long pushSeq;
+	unsigned long long decompSeq;
+	unsigned long long writeSeq;
+
+	/* Errors of decompression and of write */
+	int errors;
+	int writeFailed;
+	int closing;
+
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+};
+
+/* Decompression threads per file, 0: decompressed by the reader */
+static int decompThreads = 0;
+
+/* Zero block of the holes */
+static const uint8_t zeroBlock[UBIFS_BLOCK_SIZE];
+
+
+/**
+ * Set the number of decompression threads of a file extraction
+ */
+void decomp_set_threads(int nbThreads)
+{
+	decompThreads = nbThreads;
+}
+
+/**
+ * Expand the data of a data node in block (UBIFS_BLOCK_SIZE, zero padded)
+ * nodeLen: length of the node
+ * Return 0 or -EINVAL if the data can't be expanded
+ */
+int decomp_data_node(const struct ubifs_data_node *dn, int nodeLen, void *block)
+{
+	const uint8_t *in = dn->data;
+	int    inLen   = nodeLen - UBIFS_DATA_NODE_SZ;
+	int    size    = le32_to_cpu(dn->size);
+	int    type    = le16_to_cpu(dn->compr_type);
+	size_t outLen  = 0;
+	lzo_uint lzoLen;
+	z_stream strm;
+	int err = 0;
+
+	if ( (inLen < 0) || (size < 0) || (size > UBIFS_BLOCK_SIZE) )
+	{
+		return -EINVAL;
+	}
+
+	switch (type)
+	{
+	case UBIFS_COMPR_NONE:
+		if (inLen > UBIFS_BLOCK_SIZE)
+		{
+			return -EINVAL;
+		}
+		memcpy(block, in, inLen);
+		outLen = inLen;
+		break;
+
+	case UBIFS_COMPR_LZO:
+		lzoLen = UBIFS_BLOCK_SIZE;
+		if (lzo1x_decompress_safe(in, inLen, block, &lzoLen, NULL) != LZO_E_OK)
+		{
+			err = -EINVAL;
+		}
+		outLen = lzoLen;
+		break;
+
+	case UBIFS_COMPR_ZLIB:
+		/* Raw deflate stream, as written by the kernel and mkfs.ubifs */
+		memset(&strm, 0, sizeof(strm));
+		if (inflateInit2(&strm, -15) != Z_OK)
+		{
+			return -ENOMEM;
+		}
+		strm.next_in   = (Bytef *)in;
+		strm.avail_in  = inLen;
+		strm.next_out  = block;
+		strm.avail_out = UBIFS_BLOCK_SIZE;
+		if (inflate(&strm, Z_FINISH) != Z_STREAM_END)
+		{
+			err = -EINVAL;
+		}
+		outLen = strm.total_out;
+		inflateEnd(&strm);
+		break;
+
+	case UBIFS_COMPR_ZSTD:
+		outLen = ZSTD_decompress(block, UBIFS_BLOCK_SIZE, in, inLen);
+		if (ZSTD_isError(outLen))
+		{
+			err    = -EINVAL;
+			outLen = 0;
+		}
+		break;
+
+	default:
+		return -EINVAL;
+	}
+
+	if ( (err == 0) && (outLen != (size_t)size) )
+	{
+		err = -EINVAL;
+	}
+	if (outLen < UBIFS_BLOCK_SIZE)
+	{
+		memset((uint8_t *)block + outLen, 0, UBIFS_BLOCK_SIZE - outLen);
+	}
+	return err;
+}
+
+/**
+ * Expand a slot of the queue
+ */
+static void decomp_slot_expand(struct decomp_slot *s)
+{
+	s->err = 0;
+	if (s->nodeLen == 0)
+	{
+		memset(s->block, 0, UBIFS_BLOCK_SIZE);
+	}
+	else
+	{
+		s->err = decomp_data_node((const struct ubifs_data_node *)s->node, s->nodeLen, s->block);
+	}
+}
+
+/**
+ * Write a block in the file, and report its error
+ * hole: zero block, skipped in a sparse pipeline
+ */
+static void decomp_write(struct decomp_pipe *p, const void *block, int writeLen,
+			 int err, int hole, unsigned long long seq)
+{
+	if (err)
+	{
+		fprintf(p->log, "Unable to decompress block #%llu err:%d\n", seq, err);
+		__atomic_add_fetch(&p->errors, 1, __ATOMIC_RELAXED);
+	}
+	if (hole && p->sparse)
+	{
+		/* Run of holes: one seek before the next data */
+		p->skip += writeLen;
+	}
+	else if ( (!p->writeFailed) && (writeLen > 0) )
+	{
+		if ( (p->skip > 0) && fseeko(p->fd, p->skip, SEEK_CUR) )
+		{
+			fprintf(p->log, "Unable to seek over a hole\n");
+			p->writeFailed = 1;
+		}
+		p->skip = 0;
+		if ( (!p->writeFailed) && (1 != fwrite(block, writeLen, 1, p->fd)) )
+		{
+			fprintf(p->log, "Unable to write file\n");
+			p->writeFailed = 1;
+		}
+	}
+	if ( (p->hash != NULL) && (writeLen > 0) )
+	{
+		file_hash_update(p->hash, block, writeLen);
+	}
+}
+
+/**
+ * Decompression thread: expand the filled slots in sequence order
+ */
+static void *decomp_thread(void *arg)
+{
+	struct decomp_pipe *p = arg;
+	struct decomp_slot *s;
+
+	pthread_mutex_lock(&p->lock);
+	while (1)
+	{
+		s = &p->slots[p->decompSeq % p->nbSlots];
+		if ( (p->decompSeq < p->pushSeq) && (s->state == DECOMP_FILLED) )
+		{
+			p->decompSeq++;
+			s->state = DECOMP_WORKING;
+			pthread_mutex_unlock(&p->lock);
+
+			decomp_slot_expand(s);
+
+			pthread_mutex_lock(&p->lock);
+			s->state = DECOMP_DONE;
+			pthread_cond_broadcast(&p->cond);
+			continue;
+		}
+		if (p->closing && (p->decompSeq >= p->pushSeq))
+		{
+			break;
+		}
+		pthread_cond_wait(&p->cond, &p->lock);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+/**
+ * Writer thread: write the expanded slots in the file order
+ */
+static void *decomp_writer(void *arg)
+{
+	struct decomp_pipe *p = arg;
+	struct decomp_slot *s;
+
+	pthread_mutex_lock(&p->lock);
+	while (1)
+	{
+		s = &p->slots[p->writeSeq % p->nbSlots];
+		if ( (p->writeSeq < p->pushSeq) && (s->state == DECOMP_DONE) )
+		{
+			pthread_mutex_unlock(&p->lock);
+
+			decomp_write(p, s->block, s->writeLen, s->err, s->nodeLen == 0, p->writeSeq);
+
+			pthread_mutex_lock(&p->lock);
+			s->state = DECOMP_FREE;
+			p->writeSeq++;
+			pthread_cond_broadcast(&p->cond);
+			continue;
+		}
+		if (p->closing && (p->writeSeq >= p->pushSeq))
+		{
+			break;
+		}
+		pthread_cond_wait(&p->cond, &p->lock);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+/**
+ * Allocate the slots of the queue, with the node buffers if withNode
+ * Return 0 or -ENOMEM (the slots allocated are freed by decomp_slots_free)
+ */
+static int decomp_slots_alloc(struct decomp_pipe *p, int nbSlots, int withNode)
+{
+	int i;
+
+	p->nbSlots = nbSlots;
+	p->slots   = calloc(nbSlots, sizeof(*p->slots));
+	if (p->slots == NULL)
+	{
+		return -ENOMEM;
+	}
+	for (i=0; i<nbSlots; i++)
+	{
+		p->slots[i].block = malloc(UBIFS_BLOCK_SIZE);
+		if (withNode)
+		{
+			p->slots[i].node = malloc(UBIFS_MAX_DATA_NODE_SZ);
+		}
+		if ( (p->slots[i].block == NULL) || (withNode && (p->slots[i].node == NULL)) )
+		{
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Free the slots of the queue
+ */
+static void decomp_slots_free(struct decomp_pipe *p)
+{
+	int i;
+
+	for (i=0; (p->slots != NULL) && (i<p->nbSlots); i++)
+	{
+		free(p->slots[i].node);
+		free(p->slots[i].block);
+	}
+	free(p->slots);
+	p->slots   = NULL;
+	p->nbSlots = 0;
+}
+
+/**
+ * Stop the threads of the pipeline, once all the blocks pushed are written
+ */
+static void decomp_threads_stop(struct decomp_pipe *p)
+{
+	int i;
+
+	pthread_mutex_lock(&p->lock);
+	p->closing = 1;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+
+	for (i=0; i<p->nbThreads; i++)
+	{
+		pthread_join(p->threads[i], NULL);
+	}
+	if (p->hasWriter)
+	{
+		pthread_join(p->writer, NULL);
+	}
+	p->closing   = 0;
+	p->hasWriter = 0;
+	p->nbThreads = 0;
+}
+
+/**
+ * Start the decompression threads and the writer
+ * Return 0 or -1 (no thread left running)
+ */
+static int decomp_threads_start(struct decomp_pipe *p, int nbThreads)
+{
+	int i;
+
+	p->threads = calloc(nbThreads, sizeof(*p->threads));
+	if ( (p->threads == NULL) ||
+	     decomp_slots_alloc(p, nbThreads * DECOMP_SLOTS_PER_THREAD, 1) )
+	{
+		return -1;
+	}
+	for (i=0; i<nbThreads; i++)
+	{
+		if (pthread_create(&p->threads[i], NULL, decomp_thread, p))
+		{
+			break;
+		}
+	}
+	/* Not all the threads: the created ones are enough */
+	p->nbThreads = i;
+	p->hasWriter = (i > 0) && !pthread_create(&p->writer, NULL, decomp_writer, p);
+	if (!p->hasWriter)
+	{
+		decomp_threads_stop(p);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Open the pipeline of a file
+ * fd: the file to write, log: where to print the errors
+ * hash: digests of the data written, NULL if none
+ * sparse: seek over the holes (fd must be a regular file)
+ * Without memory or threads for the queue, the blocks are expanded and
+ * written by the reader
+ * Return NULL if out of memory
+ */
+struct decomp_pipe *decomp_pipe_open(FILE *fd, FILE *log, struct file_hash *hash, int sparse)
+{
+	struct decomp_pipe *p;
+
+	p = calloc(1, sizeof(*p));
+	if (p == NULL)
+	{
+		return NULL;
+	}
+	p->fd        = fd;
+	p->log       = log;
+	p->hash      = hash;
+	p->sparse    = sparse;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond, NULL);
+
+	if ( (decompThreads > 0) && decomp_threads_start(p, decompThreads) )
+	{
+		fprintf(log, "%s: Unable to start the decompression threads, decompressed by the reader\n", __FUNCTION__);
+		decomp_slots_free(p);
+		free(p->threads);
+		p->threads = NULL;
+	}
+
+	/* Without thread: one slot, expanded and written by the reader */
+	if ( (p->nbThreads == 0) && decomp_slots_alloc(p, 1, 0) )
+	{
+		decomp_pipe_close(p);
+		return NULL;
+	}
+	return p;
+}
+
+/**
+ * Push the next block of the file
+ * dn: the data node of the block (copied), NULL for a hole
+ * nodeLen: length of the node
+ * writeLen: bytes of the block to write
+ */
+void decomp_pipe_push(struct decomp_pipe *p, const struct ubifs_data_node *dn,
+		      int nodeLen, int writeLen)
+{
+	struct decomp_slot *s;
+
+	if ( (dn != NULL) && ((nodeLen < (int)UBIFS_DATA_NODE_SZ) || (nodeLen > (int)UBIFS_MAX_DATA_NODE_SZ)) )
+	{
+		/* Not a valid data node: written as a hole */
+		fprintf(p->log, "%s: Bad data node length %d\n", __FUNCTION__, nodeLen);
+		__atomic_add_fetch(&p->errors, 1, __ATOMIC_RELAXED);
+		dn = NULL;
+	}
+	if (writeLen > UBIFS_BLOCK_SIZE)
+	{
+		writeLen = UBIFS_BLOCK_SIZE;
+	}
+
+	/* No thread: at once */
+	if (p->nbThreads == 0)
+	{
+		if (dn == NULL)
+		{
+			decomp_write(p, zeroBlock, writeLen, 0, 1, p->pushSeq);
+		}
+		else
+		{
+			s = &p->slots[0];
+			s->err = decomp_data_node(dn, nodeLen, s->block);
+			decomp_write(p, s->block, writeLen, s->err, 0, p->pushSeq);
+		}
+		p->pushSeq++;
+		return;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	s = &p->slots[p->pushSeq % p->nbSlots];
+	while (s->state != DECOMP_FREE)
+	{
+		pthread_cond_wait(&p->cond, &p->lock);
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	/* The slot is free: no thread uses it */
+	s->nodeLen  = (dn != NULL) ? nodeLen : 0;
+	s->writeLen = writeLen;
+	if (dn != NULL)
+	{
+		memcpy(s->node, dn, nodeLen);
+	}
+
+	pthread_mutex_lock(&p->lock);
+	s->state = DECOMP_FILLED;
+	p->pushSeq++;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+}
+
+/**
+ * Wait the end of the writes, set the size of a sparse file, and free the pipeline
+ * Return the number of blocks not decompressed, -EIO if a write failed
+ */
+int decomp_pipe_close(struct decomp_pipe *p)
+{
+	int ret;
+
+	/* Wait the end of the writes */
+	decomp_threads_stop(p);
+
+	/* File ending with a hole: its size, without writing it */
+	if ( (p->skip > 0) && (!p->writeFailed) )
+	{
+		if ( fflush(p->fd) ||
+		     ftruncate(fileno(p->fd), ftello(p->fd) + p->skip) )
+		{
+			fprintf(p->log, "Unable to set the size of the file\n");
+			p->writeFailed = 1;
+		}
+	}
+
+	ret = p->writeFailed ? -EIO : p->errors;
+
+	decomp_slots_free(p);
+	free(p->threads);
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->cond);
+	free(p);
+	return ret;
+}
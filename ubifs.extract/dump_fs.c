@@ -20,10 +20,9 @@
 static void dump_file(struct ubifs_info *c, uint64_t inode)
 {
 	uint64_t inoSize;
-	unsigned int blockNum;
-	union ubifs_key key;
-	int n;
-	struct ubifs_znode *znode;
+	unsigned int endBlock;
+	struct ads_tnc_iter it;
+	struct ads_tnc_extent ext;
 	int lnum, lastLnum;
 	uint64_t len;
 	int ret;
@@ -35,31 +34,29 @@ static void dump_file(struct ubifs_info *c, uint64_t inode)
 	inoSize = ads_print_ino_node(c, inode);
 
 
-	blockNum   =  0;
+	endBlock   = (inoSize + UBIFS_BLOCK_SIZE - 1) / UBIFS_BLOCK_SIZE;
 	len        =  0;
 	lastLnum   = -1;
         nbPrint    =  0;
 	dirtyLine  =  0;
 	hole_block = -1;
-	while (inoSize > (blockNum*UBIFS_BLOCK_SIZE) )
+
+	/* Walk the data nodes of the file, from a single descent of the TNC */
+	ret = ads_tnc_iter_init(c, &it, inode, 0, endBlock);
+	while ( (ret == 0) && ((ret = ads_tnc_iter_next(&it, &ext)) == 1) )
 	{
-		/* Generate a data key */
-		data_key_init(c, &key, inode, blockNum);
-		/* Find a level 0 data node */
-		ret = ubifs_lookup_level0(
-					c,
-					&key,
-                                        &znode,
-					&n);
-		/* Entry not found, hole in file, block with data set to zero */
-		if ( (ret != 1) && (hole_block == -1) )
-		{
-			hole_block = blockNum;
-		}
+		ret = 0;
 
-		/* Entry found and it was an hole (return to a normal situation) */
-		if ( (ret == 1) && (hole_block != -1) )
+		/* Hole in file, block with data set to zero */
+		if (ext.lnum < 0)
 		{
+			/* Zero at the end of the file, printed after the loop */
+			if (ext.block + ext.count >= endBlock)
+			{
+				hole_block = ext.block;
+				continue;
+			}
+
 			if (dirtyLine)
 			{
 				printf("\n");
@@ -67,22 +64,14 @@ static void dump_file(struct ubifs_info *c, uint64_t inode)
 			}
 			/* Print the hole area */
 			printf("No Entry from 0x%llX to 0x%llX (sparse area?zero in file)\n", 
-				((uint64_t)hole_block)*UBIFS_BLOCK_SIZE,
-				((uint64_t)blockNum)*UBIFS_BLOCK_SIZE - 1);
-			/* End of the hole */
-			hole_block = -1;
-		}
-
-		/* No entry found */
-		if (ret != 1)
-		{
-			blockNum++;
+				((uint64_t)ext.block)*UBIFS_BLOCK_SIZE,
+				((uint64_t)(ext.block + ext.count))*UBIFS_BLOCK_SIZE - 1);
 			continue;
 		}
 
-		/* Use information provided by the lookup function */
-		lnum  = znode->zbranch[n].lnum;
-		len  += znode->zbranch[n].len - offsetof(struct ubifs_data_node,data);
+		/* Use information provided by the iterator */
+		lnum  = ext.lnum;
+		len  += ext.len - offsetof(struct ubifs_data_node,data);
 
 		/* Many data node in the same LEB, print LEB # only one time */
 		if (lnum != lastLnum)
@@ -99,12 +88,15 @@ static void dump_file(struct ubifs_info *c, uint64_t inode)
                 	}
 			nbPrint++;
 		}
-		blockNum++;
 	}
 	if (dirtyLine)
 	{
 		printf("\n");
 	}
+	if (ret < 0)
+	{
+		printf("Error walking the TNC of inode %lld: %d\n", inode, ret);
+	}
 	/* Zero at the end of the file, notify the user */
 	if (hole_block != -1)
 	{
@@ -0,0 +1,564 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * This file is part of UBIFS.
+ *
+ * Copyright (C) 2025 AIRBUS Defence & Space
+ *
+ * Authors: Frederic Fraysse
+ */
+
+/*
+ * Extraction of a list of files in the physical order of their data nodes.
+ * The locations of the data nodes of all the files are collected from the
+ * TNC, sorted by LEB and offset, then each LEB is read once (from its first
+ * to its last node) and each block is written at its place in its output
+ * file with a positional write.
+ * The extraction time depends on the number of LEBs touched instead of the
+ * number of blocks.
+ * The holes are never written: the files are sparse, their size set at the
+ * end.
+ * The LEB reads are queued ahead with leb_aio (io_uring with -U), the LEBs
+ * are written in their completion order.
+ * The digests are computed on the blocks written in the order of the file;
+ * only the end of a file after a block written out of order (or a hole) is
+ * read back from the file.
+ */
+
+#include "ads_dump.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+
+/* A data node to extract */
+struct batch_node
+{
+	int lnum;
+	int offs;
+	int len;
+	/* Index in the file list, and block in the file */
+	int file;
+	unsigned int block;
+};
+
+/* A file to extract */
+struct batch_file
+{
+	struct ubifs_dent_node *dent;
+	char     path[400];
+	int      fd;
+	uint64_t size;
+
+	/* Data nodes written, and in error */
+	unsigned long long nodes;
+	unsigned long long errors;
+
+	/* Holes not written, and their bytes */
+	unsigned int holes;
+	uint64_t     holeSize;
+
+	/* Digests, NULL: none, and bytes of the file already hashed */
+	struct file_hash *hash;
+	uint64_t hashed;
+};
+
+/* LEB reads queued ahead (in flight at the same time with io_uring) */
+#define BATCH_READ_AHEAD (4)
+
+/* 0: disabled */
+static int batchEnabled = 0;
+
+
+/**
+ * Enable the extraction in physical order
+ */
+void extract_batch_set_enabled(int enable)
+{
+	batchEnabled = enable;
+}
+
+/**
+ * Return 1 if the extraction in physical order is enabled
+ */
+int extract_batch_is_enabled(void)
+{
+	return batchEnabled;
+}
+
+/**
+ * qsort: order of the nodes on the flash
+ */
+static int extract_batch_cmp(const void *a, const void *b)
+{
+	const struct batch_node *na = a;
+	const struct batch_node *nb = b;
+
+	if (na->lnum != nb->lnum)
+	{
+		return (na->lnum < nb->lnum) ? -1 : 1;
+	}
+	return (na->offs < nb->offs) ? -1 : (na->offs > nb->offs);
+}
+
+/**
+ * Check a read data node: header, CRC and key of the block
+ */
+static int extract_batch_node_ok(
+		struct ubifs_info *c,
+		const struct ubifs_data_node *dn,
+		const struct batch_node *bn,
+		uint64_t inum)
+{
+	union ubifs_key key;
+	union ubifs_key nodeKey;
+
+	if ( (dn->ch.node_type != UBIFS_DATA_NODE) ||
+	     (le32_to_cpu(dn->ch.len) != bn->len) ||
+	     ubifs_check_node(c, dn, bn->len, bn->lnum, bn->offs, 1, 0) )
+	{
+		return 0;
+	}
+	data_key_init(c, &key, inum, bn->block);
+	key_read(c, &dn->key, &nodeKey);
+	return keys_cmp(c, &key, &nodeKey) == 0;
+}
+
+/**
+ * Write a data node at the place of its block
+ */
+static void extract_batch_write(struct batch_file *f, const struct ubifs_data_node *dn, unsigned int block)
+{
+	uint8_t  data[UBIFS_BLOCK_SIZE];
+	uint64_t offs = (uint64_t)block * UBIFS_BLOCK_SIZE;
+	size_t   partSize;
+
+	/* Expanded (LZO, zlib, zstd), the block is cut at the end of the file */
+	if (decomp_data_node(dn, le32_to_cpu(dn->ch.len), data))
+	{
+		printf("%s: Unable to decompress %s block %u\n", __FUNCTION__, f->path, block);
+		f->errors++;
+		return;
+	}
+	if (offs >= f->size)
+	{
+		return;
+	}
+	partSize = (f->size - offs >= UBIFS_BLOCK_SIZE) ? UBIFS_BLOCK_SIZE : (f->size - offs);
+	if (pwrite(f->fd, data, partSize, offs) != (ssize_t)partSize)
+	{
+		printf("%s: Unable to write %s block %u\n", __FUNCTION__, f->path, block);
+		f->errors++;
+		return;
+	}
+	f->nodes++;
+
+	/* Next block of the file: hashed now, no read back */
+	if ( (f->hash != NULL) && (offs == f->hashed) )
+	{
+		file_hash_update(f->hash, data, partSize);
+		f->hashed += partSize;
+	}
+}
+
+/**
+ * Hash the end of a file not hashed while written (blocks out of order,
+ * holes): read back from the file
+ * Return the bytes read back
+ */
+static uint64_t extract_batch_hash_tail(struct batch_file *f)
+{
+	uint8_t  buf[UBIFS_BLOCK_SIZE * 16];
+	uint64_t readBack = 0;
+	size_t   len;
+	ssize_t  n;
+
+	while ( (f->hash != NULL) && (f->hashed < f->size) )
+	{
+		len = (f->size - f->hashed > sizeof(buf)) ? sizeof(buf) : (f->size - f->hashed);
+		n   = pread(f->fd, buf, len, f->hashed);
+		if (n <= 0)
+		{
+			printf("%s: Unable to read back %s\n", __FUNCTION__, f->path);
+			break;
+		}
+		file_hash_update(f->hash, buf, n);
+		f->hashed += n;
+		readBack  += n;
+	}
+	return readBack;
+}
+
+/**
+ * Node not readable from the LEB read (or the TNC walk failed):
+ * locate and read it alone, the errors are printed
+ */
+static void extract_batch_node_alone(
+		struct ubifs_info *c,
+		struct batch_file *f,
+		unsigned int block,
+		void *buf)
+{
+	const struct ubifs_data_node *dn;
+	union ubifs_key key;
+	int lnum;
+	int offs;
+	int err;
+
+	data_key_init(c, &key, f->dent->inum, block);
+	err = ads_tnc_read_node(c, &key, buf, (const void **)&dn, &lnum, &offs);
+	if (err == -ENOENT)
+	{
+		/* Hole */
+		f->holeSize += ads_fprint_hole(stdout, f->path, block, 1, f->size);
+		f->holes++;
+		return;
+	}
+	if (err)
+	{
+		printf("%s: %s block %u err:%d (%s)\n", __FUNCTION__, f->path, block, err, strerror(-err));
+		f->errors++;
+		return;
+	}
+	extract_batch_write(f, dn, block);
+}
+
+/**
+ * Add the data nodes of a file to the list
+ * The blocks after an error of the TNC walk are read one by one at once
+ * Return 0 or -ENOMEM
+ */
+static int extract_batch_collect(
+		struct ubifs_info *c,
+		struct batch_file *f,
+		int file,
+		struct batch_node **nodes,
+		int *nbNodes,
+		int *maxNodes,
+		void *buf)
+{
+	struct ads_tnc_iter   it;
+	struct ads_tnc_extent ext;
+	struct batch_node *grown;
+	unsigned int nbBlocks;
+	unsigned int block;
+	int ret;
+
+	nbBlocks = (f->size + UBIFS_BLOCK_SIZE - 1) / UBIFS_BLOCK_SIZE;
+	ret = ads_tnc_iter_init(c, &it, f->dent->inum, 0, nbBlocks);
+	while (ret == 0)
+	{
+		ret = ads_tnc_iter_next(&it, &ext);
+		if (ret <= 0)
+		{
+			break;
+		}
+		ret = 0;
+		if (ext.lnum < 0)
+		{
+			/* Hole: not written */
+			f->holeSize += ads_fprint_hole(stdout, f->path, ext.block, ext.count, f->size);
+			f->holes++;
+			continue;
+		}
+		if ((*nbNodes) >= (*maxNodes))
+		{
+			(*maxNodes) = (*maxNodes) ? 2 * (*maxNodes) : 1024;
+			grown = realloc(*nodes, (*maxNodes) * sizeof(**nodes));
+			if (grown == NULL)
+			{
+				return -ENOMEM;
+			}
+			(*nodes) = grown;
+		}
+		(*nodes)[*nbNodes].lnum  = ext.lnum;
+		(*nodes)[*nbNodes].offs  = ext.offs;
+		(*nodes)[*nbNodes].len   = ext.len;
+		(*nodes)[*nbNodes].file  = file;
+		(*nodes)[*nbNodes].block = ext.block;
+		(*nbNodes)++;
+	}
+
+	if (ret < 0)
+	{
+		printf("%s: TNC walk of %s err:%d, block %u and next read one by one\n",
+				__FUNCTION__, f->path, ret, it.block);
+		for (block = it.block; block < nbBlocks; block++)
+		{
+			extract_batch_node_alone(c, f, block, buf);
+		}
+	}
+	return 0;
+}
+
+/**
+ * Range of the LEB of nodes[first] to read: from its first to its last node
+ * Return the index after its last node
+ */
+static int extract_batch_span(
+		struct ubifs_info *c,
+		const struct batch_node *nodes,
+		int nbNodes,
+		int first,
+		int *start,
+		int *end)
+{
+	int ioSize = (c->min_io_size > 0) ? c->min_io_size : 1;
+	int last;
+
+	*end = 0;
+	for (last = first; (last < nbNodes) && (nodes[last].lnum == nodes[first].lnum); last++)
+	{
+		if (nodes[last].offs + nodes[last].len > *end)
+		{
+			*end = nodes[last].offs + nodes[last].len;
+		}
+	}
+	*start = nodes[first].offs / ioSize * ioSize;
+	*end   = (*end + ioSize - 1) / ioSize * ioSize;
+	if (*end > c->leb_size)
+	{
+		*end = c->leb_size;
+	}
+	return last;
+}
+
+/**
+ * Write the nodes first to last of a LEB
+ * leb: the LEB (read or mapped), err: error of its read
+ * lebBuf: the buffer of the LEB read, NULL for a mapped image
+ */
+static void extract_batch_leb(
+		struct ubifs_info *c,
+		struct ubifs_read_ctx *ctx,
+		struct batch_file *files,
+		const struct batch_node *nodes,
+		int first,
+		int last,
+		const uint8_t *leb,
+		int err,
+		uint8_t *lebBuf,
+		void *nodeBuf)
+{
+	const struct batch_node *bn;
+	const struct ubifs_data_node *dn;
+	int i;
+
+	for (i=first; i<last; i++)
+	{
+		bn = &nodes[i];
+		dn = NULL;
+		if (err == 0)
+		{
+			dn = (const struct ubifs_data_node *)(leb + bn->offs);
+		}
+		else if ( (lebBuf != NULL) &&
+			  (ubifs_leb_read_r(c, ctx, bn->lnum, lebBuf + bn->offs, bn->offs, bn->len, 0) == 0) )
+		{
+			/* Keep the nodes readable of a LEB with errors */
+			dn = (const struct ubifs_data_node *)(lebBuf + bn->offs);
+		}
+
+		if ( (dn != NULL) && extract_batch_node_ok(c, dn, bn, files[bn->file].dent->inum) )
+		{
+			extract_batch_write(&files[bn->file], dn, bn->block);
+		}
+		else
+		{
+			extract_batch_node_alone(c, &files[bn->file], bn->block, nodeBuf);
+		}
+	}
+}
+
+/**
+ * Extract the files in the physical order of their data nodes
+ * dents: the files to extract, in outDir
+ * hashes: digests of each file (entries NULL: no digest), not ended
+ */
+void extract_batch_run(
+		struct ubifs_info *c,
+		struct ubifs_dent_node **dents,
+		struct file_hash **hashes,
+		int nbFiles,
+		const char *outDir)
+{
+	struct ubifs_read_ctx ctx;
+	struct batch_file *files;
+	struct batch_node *nodes = NULL;
+	struct leb_aio *aio = NULL;
+	struct leb_aio_req reads[BATCH_READ_AHEAD];
+	struct leb_aio_req *done;
+	int lastOf[BATCH_READ_AHEAD];
+	int firstOf[BATCH_READ_AHEAD];
+	const uint8_t *leb;
+	uint8_t *lebBufs = NULL;
+	uint8_t *lebBuf;
+	void    *nodeBuf;
+	int nbNodes  = 0;
+	int maxNodes = 0;
+	int image = peb_leb_is_image();
+	int first, last, i, slot;
+	int start, end;
+	int nbLebs = 0;
+	int err;
+	unsigned long long readBytes = 0;
+	unsigned long long hashBytes = 0;
+
+	files   = calloc(nbFiles, sizeof(*files));
+	nodeBuf = malloc(UBIFS_MAX_DATA_NODE_SZ);
+	if (!image)
+	{
+		lebBufs = malloc((size_t)BATCH_READ_AHEAD * c->leb_size);
+		aio     = leb_aio_open(c, BATCH_READ_AHEAD);
+	}
+	if ( (files == NULL) || (nodeBuf == NULL) || ((!image) && ((lebBufs == NULL) || (aio == NULL))) )
+	{
+		printf("%s: Out of memory\n", __FUNCTION__);
+		free(files);
+		free(nodeBuf);
+		free(lebBufs);
+		leb_aio_close(aio);
+		return;
+	}
+
+	/* Open the files and collect their data nodes */
+	for (i=0; i<nbFiles; i++)
+	{
+		files[i].dent = dents[i];
+		files[i].fd   = -1;
+		files[i].hash = hashes[i];
+		files[i].size = ads_print_ino_node(c, dents[i]->inum);
+		snprintf(files[i].path, sizeof(files[i].path), "%s/%s", outDir, dents[i]->name);
+		printf("Extract file:%s size:%lld\n", dents[i]->name, files[i].size);
+		if (files[i].size == ~0ULL)
+		{
+			continue;
+		}
+
+		/* Read and write: the end of the file may be read back to hash it */
+		files[i].fd = open(files[i].path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (files[i].fd < 0)
+		{
+			printf("%s: Unable to open %s to write\n", __FUNCTION__, files[i].path);
+			continue;
+		}
+		if (extract_batch_collect(c, &files[i], i, &nodes, &nbNodes, &maxNodes, nodeBuf))
+		{
+			printf("%s: Out of memory\n", __FUNCTION__);
+			break;
+		}
+	}
+
+	qsort(nodes, nbNodes, sizeof(*nodes), extract_batch_cmp);
+
+	ubifs_read_ctx_init(c, &ctx);
+
+	if (image)
+	{
+		/* Memory mapped image: each LEB is used in place */
+		for (first = 0; first < nbNodes; first = last)
+		{
+			last = extract_batch_span(c, nodes, nbNodes, first, &start, &end);
+			nbLebs++;
+			readBytes += end - start;
+			leb = peb_leb_map_leb(nodes[first].lnum, 0, end);
+			extract_batch_leb(c, &ctx, files, nodes, first, last, leb, (leb != NULL) ? 0 : -EIO, NULL, nodeBuf);
+		}
+	}
+	else
+	{
+		/* Read each LEB once, from its first to its last node, ahead */
+		for (slot = 0; slot < BATCH_READ_AHEAD; slot++)
+		{
+			reads[slot].priv = NULL;
+		}
+		first = 0;
+		while (1)
+		{
+			/* Queue the next LEBs in the free buffers */
+			for (slot = 0; (slot < BATCH_READ_AHEAD) && (first < nbNodes); slot++)
+			{
+				if (reads[slot].priv != NULL)
+				{
+					continue;
+				}
+				last   = extract_batch_span(c, nodes, nbNodes, first, &start, &end);
+				lebBuf = lebBufs + (size_t)slot * c->leb_size;
+				reads[slot].lnum = nodes[first].lnum;
+				reads[slot].offs = start;
+				reads[slot].len  = end - start;
+				reads[slot].buf  = lebBuf + start;
+				reads[slot].priv = lebBuf;
+				firstOf[slot] = first;
+				lastOf[slot]  = last;
+				nbLebs++;
+				readBytes += end - start;
+				leb_aio_submit(aio, &reads[slot]);
+				first = last;
+			}
+
+			/* Write the nodes of a LEB read */
+			err = leb_aio_complete(aio, &done);
+			if (err < 0)
+			{
+				/* Queue broken: the nodes left are read one by one
+				 * (not in the buffers, the kernel may still fill them) */
+				printf("%s: Read queue err:%d, nodes left read one by one\n", __FUNCTION__, err);
+				for (slot = 0; slot < BATCH_READ_AHEAD; slot++)
+				{
+					if (reads[slot].priv != NULL)
+					{
+						extract_batch_leb(c, &ctx, files, nodes, firstOf[slot], lastOf[slot], NULL, err, NULL, nodeBuf);
+					}
+				}
+				extract_batch_leb(c, &ctx, files, nodes, first, nbNodes, NULL, err, NULL, nodeBuf);
+				break;
+			}
+			if (err == 0)
+			{
+				break;
+			}
+			slot   = done - reads;
+			lebBuf = done->priv;
+			err    = done->err;
+			extract_batch_leb(c, &ctx, files, nodes, firstOf[slot], lastOf[slot], lebBuf, err, lebBuf, nodeBuf);
+			done->priv = NULL;
+		}
+	}
+
+	/* The holes and the end of the files */
+	for (i=0; i<nbFiles; i++)
+	{
+		if (files[i].fd < 0)
+		{
+			continue;
+		}
+		if (ftruncate(files[i].fd, files[i].size))
+		{
+			printf("%s: Unable to set the size of %s\n", __FUNCTION__, files[i].path);
+		}
+		hashBytes += extract_batch_hash_tail(&files[i]);
+		close(files[i].fd);
+		printf("Extracted file:%s nodes:%llu errors:%llu holes:%u (%llu bytes not written)\n",
+				files[i].path,
+				files[i].nodes,
+				files[i].errors,
+				files[i].holes,
+				(unsigned long long)files[i].holeSize);
+	}
+	printf("Physical order extraction: %d files, %d data nodes, %d LEBs read (%llu bytes)%s\n",
+			nbFiles,
+			nbNodes,
+			nbLebs,
+			readBytes,
+			((aio != NULL) && leb_aio_is_async(aio)) ? " with io_uring" : "");
+	if (hashBytes != 0)
+	{
+		printf("Digests: %llu bytes read back (blocks not written in the file order)\n", hashBytes);
+	}
+
+	leb_aio_close(aio);
+	free(nodes);
+	free(files);
+	free(nodeBuf);
+	free(lebBufs);
+}
@@ -32,7 +32,7 @@ static struct ubifs_info *c = &info_;
 
 int exit_code = FSCK_OK;
 
-static const char *optstring = "Vrgl:abyn";
+static const char *optstring = "Vrgl:abynj:C:m:i:G:u:RHP:UE:S::XW:D:T:K:M:";
 
 static const struct option longopts[] = {
 	{"version",            0, NULL, 'V'},
@@ -43,6 +43,24 @@ static const struct option longopts[] = {
 	{"rebuild",            1, NULL, 'b'},
 	{"yes",                1, NULL, 'y'},
 	{"nochange",           1, NULL, 'n'},
+	{"threads",            1, NULL, 'j'},
+	{"cache",              1, NULL, 'C'},
+	{"mtd",                1, NULL, 'm'},
+	{"image",              1, NULL, 'i'},
+	{"geometry",           1, NULL, 'G'},
+	{"vol-id",             1, NULL, 'u'},
+	{"raw",                0, NULL, 'R'},
+	{"check-hdr-crc",      0, NULL, 'H'},
+	{"read-cache",         1, NULL, 'P'},
+	{"io-uring",           0, NULL, 'U'},
+	{"read-retry",         1, NULL, 'E'},
+	{"io-stats",           2, NULL, 'S'},
+	{"phys-order",         0, NULL, 'X'},
+	{"extract-threads",    1, NULL, 'W'},
+	{"decomp-threads",     1, NULL, 'D'},
+	{"archive",            1, NULL, 'T'},
+	{"hash",               1, NULL, 'K'},
+	{"manifest",           1, NULL, 'M'},
 	{NULL, 0, NULL, 0}
 };
 
@@ -51,6 +69,26 @@ static const char *helptext =
 "Check & repair UBIFS filesystem on a given UBI volume\n\n"
 "Options:\n"
 "-l                       Dump a LEB\n"
+"-j, --threads=NUM        Number of threads scanning the PEB (0 - one per CPU[default], 1 - no thread)\n"
+"-C, --cache=FILE         Cache file of the PEB/LEB association, used while the MTD device is not changed\n"
+"-m, --mtd=DEVICE         MTD device containing the UBI volume (default /dev/mtd1)\n"
+"-i, --image=FILE         Read the UBIFS from a raw NAND image (nanddump without OOB), without UBI\n"
+"-G, --geometry=EB:MINIO  Erase block size and min I/O size of the image (default: read FILE.geometry)\n"
+"-R, --raw                Read the UBIFS from the MTD device without attaching UBI\n"
+"-H, --check-hdr-crc      Check the CRC of the UBI EC and VID headers while scanning the PEB\n"
+"-P, --read-cache=MB      Size of the cache of the LEB reads in MiB (default 0 - no cache)\n"
+"-U, --io-uring           Queue the node reads with io_uring (synchronous reads if not available)\n"
+"-E, --read-retry=NUM     Reads of a page in error before failing without reading it (default 1, -1 - always read)\n"
+"-S, --io-stats[=FILE]    Print the I/O statistics at exit, or write them as JSON to FILE (-SFILE)\n"
+"-X, --phys-order         Extract the files in the physical order of their data nodes (each LEB read once)\n"
+"-W, --extract-threads=NUM\n"
+"                         Threads extracting the files in parallel (default 0 - one by one), logs kept in the list order\n"
+"-D, --decomp-threads=NUM Threads decompressing the blocks of a file (default 0 - by the reader)\n"
+"-T, --archive=FORMAT     Stream the extracted files to stdout as a tar or cpio archive, messages on stderr\n"
+"-K, --hash=LIST          Digests of the extracted files: md5,sha256,xxh64 or none (default: md5)\n"
+"-M, --manifest=FILE      Manifest of the digests (default: /home/root/extract.sums, none with -T),\n"
+"                         FILE.md5, FILE.sha256, FILE.xxh64 with several algorithms\n"
+"-u, --vol-id=ID          UBI volume containing the UBIFS in the image or MTD device (default: first volume)\n"
 "-V, --version            Display version information\n"
 "-g, --debug=LEVEL        Display debug information (0 - none, 1 - error message,\n"
 "                         2 - warning message[default], 3 - notice message, 4 - debug message)\n"
@@ -87,6 +125,12 @@ static void get_options(int argc, char *argv[], int *mode)
 {
 	int opt, i, submode = 0;
 	 int lebToDump;
+	int nbThread;
+	int ebSize, minIoSize, volId;
+	long cacheMb;
+	int readRetry;
+	int extractThreads;
+	int decompThreads;
 	char *endp;
 
 	while (1) {
@@ -114,6 +158,106 @@ static void get_options(int argc, char *argv[], int *mode)
                                 usage();
                         }
                         break;
+		case 'j':
+			nbThread = strtol(optarg, &endp, 0);
+			if (*endp != '\0' || endp == optarg ||
+			    nbThread < 0) {
+				log_err(c, 0, "bad number of threads '%s'", optarg);
+				usage();
+			}
+			peb_leb_set_threads(nbThread);
+			break;
+		case 'C':
+			peb_leb_set_cache_file(optarg);
+			break;
+		case 'm':
+			ads_set_mtd_device(optarg);
+			break;
+		case 'i':
+			raw_vol_set_image(optarg);
+			break;
+		case 'G':
+			if (sscanf(optarg, "%i:%i", &ebSize, &minIoSize) != 2 ||
+			    ebSize <= 0 || minIoSize <= 0) {
+				log_err(c, 0, "bad geometry '%s'", optarg);
+				usage();
+			}
+			raw_vol_set_geometry(ebSize, minIoSize);
+			break;
+		case 'u':
+			volId = strtol(optarg, &endp, 0);
+			if (*endp != '\0' || endp == optarg || volId < 0) {
+				log_err(c, 0, "bad volume id '%s'", optarg);
+				usage();
+			}
+			raw_vol_set_vol_id(volId);
+			break;
+		case 'R':
+			raw_vol_set_raw_mtd(1);
+			break;
+		case 'H':
+			peb_leb_set_hdr_crc_check(1);
+			break;
+		case 'P':
+			cacheMb = strtol(optarg, &endp, 0);
+			if (*endp != '\0' || endp == optarg ||
+			    cacheMb < 0) {
+				log_err(c, 0, "bad read cache size '%s'", optarg);
+				usage();
+			}
+			leb_cache_set_size(cacheMb * 1024LL * 1024LL);
+			break;
+		case 'U':
+			leb_aio_set_enabled(1);
+			break;
+		case 'X':
+			extract_batch_set_enabled(1);
+			break;
+		case 'W':
+			extractThreads = strtol(optarg, &endp, 0);
+			if (*endp != '\0' || endp == optarg ||
+			    extractThreads < 0) {
+				log_err(c, 0, "bad number of extraction threads '%s'", optarg);
+				usage();
+			}
+			ads_set_extract_threads(extractThreads);
+			break;
+		case 'D':
+			decompThreads = strtol(optarg, &endp, 0);
+			if (*endp != '\0' || endp == optarg ||
+			    decompThreads < 0) {
+				log_err(c, 0, "bad number of decompression threads '%s'", optarg);
+				usage();
+			}
+			decomp_set_threads(decompThreads);
+			break;
+		case 'T':
+			if (archive_set_format(optarg)) {
+				log_err(c, 0, "bad archive format '%s' (tar or cpio)", optarg);
+				usage();
+			}
+			break;
+		case 'K':
+			if (file_hash_set_algos(optarg)) {
+				log_err(c, 0, "bad hash list '%s' (md5, sha256, xxh64 or none)", optarg);
+				usage();
+			}
+			break;
+		case 'M':
+			file_hash_set_manifest(optarg);
+			break;
+		case 'E':
+			readRetry = strtol(optarg, &endp, 0);
+			if (*endp != '\0' || endp == optarg ||
+			    readRetry < -1) {
+				log_err(c, 0, "bad read retry count '%s'", optarg);
+				usage();
+			}
+			bad_pages_set_retry(readRetry);
+			break;
+		case 'S':
+			io_stats_set(1, optarg);
+			break;
 
 			
 		case 'a':
@@ -163,6 +307,11 @@ conflict_opt:
 		}
 	}
 
+	/* Without UBI, the image or the MTD device is the volume */
+	if (!c->dev_name && raw_vol_is_enabled()) {
+		c->dev_name = strdup("raw");
+	}
+
 	if (!c->dev_name) {
 		log_err(c, 0, "no ubi_volume specified");
 		usage();
@@ -609,7 +758,20 @@ int main(int argc, char *argv[])
 		goto out_exit;
 	}
 
-	err = ubifs_open_volume(c, c->dev_name);
+	/* The archive takes stdout, before any message */
+	if (archive_is_enabled()) {
+		err = archive_open();
+		if (err) {
+			log_err(c, -err, "cannot open the archive");
+			exit_code |= FSCK_ERROR;
+			goto out_destroy_fsck;
+		}
+	}
+
+	if (raw_vol_is_enabled())
+		err = raw_vol_open(c);
+	else
+		err = ubifs_open_volume(c, c->dev_name);
 	if (err) {
 		exit_code |= FSCK_ERROR;
 		goto out_destroy_fsck;
@@ -662,7 +824,16 @@ int main(int argc, char *argv[])
 	}
 
 out_close:
-	ubifs_close_volume(c);
+	archive_close();
+	io_stats_print();
+	read_plan_print_stats();
+	bad_pages_print();
+	leb_cache_print_stats();
+	leb_cache_free();
+	if (raw_vol_is_enabled())
+		raw_vol_close(c);
+	else
+		ubifs_close_volume(c);
 out_destroy_fsck:
 	destroy_fsck_info(c);
 out_exit:
@@ -0,0 +1,668 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * This file is part of UBIFS.
+ *
+ * Copyright (C) 2025 AIRBUS Defence & Space
+ *
+ * Authors: Frederic Fraysse
+ */
+
+/*
+ * Digests of the extracted files (MD5, SHA-256, XXH64) computed on the
+ * blocks while they are written, instead of running md5sum on the files
+ * written (a fork and a second read of each file).
+ * The digests are printed like md5sum / sha256sum, and written to a
+ * manifest in the tagged format ("MD5 (file) = ...") checked later with
+ * "md5sum -c", "sha256sum -c" or "xxhsum -c". A checker rejects the lines
+ * of the other algorithms: with several algorithms, one manifest is written
+ * per algorithm, its name suffixed with the algorithm (FILE.md5...).
+ */
+
+#include "ads_dump.h"
+
+
+/* Default manifest */
+#define HASH_MANIFEST ("/home/root/extract.sums")
+
+/* Algorithms */
+#define HASH_MD5    (1 << 0)
+#define HASH_SHA256 (1 << 1)
+#define HASH_XXH64  (1 << 2)
+
+/* Number of algorithms, index of an algorithm in the manifest tables */
+#define HASH_NB_ALGOS (3)
+
+/* Digests of a file */
+struct file_hash
+{
+	struct
+	{
+		uint32_t state[4];
+		uint64_t len;
+		uint8_t  buf[64];
+	}
+	md5;
+
+	struct
+	{
+		uint32_t state[8];
+		uint64_t len;
+		uint8_t  buf[64];
+	}
+	sha256;
+
+	struct
+	{
+		uint64_t acc[4];
+		uint64_t len;
+		uint8_t  buf[32];
+	}
+	xxh64;
+
+	/* Hexadecimal digests, set by file_hash_final */
+	char md5Hex[33];
+	char sha256Hex[65];
+	char xxh64Hex[17];
+
+	/* 1: the digests are ended, the next file_hash_final does nothing */
+	int finalized;
+};
+
+/* Algorithms computed */
+static int hashAlgos = HASH_MD5;
+
+/* Manifest file, NULL: none */
+static const char *manifestFile = HASH_MANIFEST;
+
+/* Manifest of each algorithm, opened at the first file */
+static FILE *manifest[HASH_NB_ALGOS];
+static char  manifestName[HASH_NB_ALGOS][400];
+
+/* Tag in the manifest, and suffix of its name with several algorithms */
+static const char *const hashTag[HASH_NB_ALGOS]    = { "MD5", "SHA256", "XXH64" };
+static const char *const hashSuffix[HASH_NB_ALGOS] = { "md5", "sha256", "xxh64" };
+
+/* 1: manifestFile is the default one (not set by file_hash_set_manifest) */
+static int manifestIsDefault = 1;
+
+
+/**
+ * Select the algorithms: list of md5, sha256, xxh64 separated by ','
+ * "none": no digest
+ * Return 0 or -1 if an algorithm is unknown
+ */
+int file_hash_set_algos(const char *list)
+{
+	const char *p = list;
+	size_t len;
+	int algos = 0;
+
+	while (*p)
+	{
+		len = strcspn(p, ",");
+		if ( (len == 3) && !strncmp(p, "md5", 3) )
+		{
+			algos |= HASH_MD5;
+		}
+		else if ( (len == 6) && !strncmp(p, "sha256", 6) )
+		{
+			algos |= HASH_SHA256;
+		}
+		else if ( (len == 5) && !strncmp(p, "xxh64", 5) )
+		{
+			algos |= HASH_XXH64;
+		}
+		else if ( (len != 4) || strncmp(p, "none", 4) )
+		{
+			return -1;
+		}
+		p += len;
+		if (*p == ',')
+		{
+			p++;
+		}
+	}
+	hashAlgos = algos;
+	return 0;
+}
+
+/**
+ * Set the manifest file, NULL: no manifest
+ */
+void file_hash_set_manifest(const char *file)
+{
+	manifestFile      = file;
+	manifestIsDefault = 0;
+}
+
+/**
+ * No manifest if not set by file_hash_set_manifest: the default one is on
+ * the target storage
+ */
+void file_hash_drop_default_manifest(void)
+{
+	if (manifestIsDefault)
+	{
+		manifestFile = NULL;
+	}
+}
+
+/**
+ * Return 1 if digests are computed
+ */
+int file_hash_is_enabled(void)
+{
+	return hashAlgos != 0;
+}
+
+
+/* MD5 (RFC 1321) */
+
+static const uint32_t md5K[64] =
+{
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const uint8_t md5R[64] =
+{
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+static inline uint32_t rol32(uint32_t x, int n)
+{
+	return (x << n) | (x >> (32 - n));
+}
+
+static void md5_block(uint32_t *state, const uint8_t *blk)
+{
+	uint32_t m[16];
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint32_t f, t;
+	int i, g;
+
+	for (i=0; i<16; i++)
+	{
+		m[i] = blk[i * 4] | (blk[i * 4 + 1] << 8) | (blk[i * 4 + 2] << 16) | ((uint32_t)blk[i * 4 + 3] << 24);
+	}
+	for (i=0; i<64; i++)
+	{
+		if (i < 16)
+		{
+			f = (b & c) | (~b & d);
+			g = i;
+		}
+		else if (i < 32)
+		{
+			f = (d & b) | (~d & c);
+			g = (5 * i + 1) & 15;
+		}
+		else if (i < 48)
+		{
+			f = b ^ c ^ d;
+			g = (3 * i + 5) & 15;
+		}
+		else
+		{
+			f = c ^ (b | ~d);
+			g = (7 * i) & 15;
+		}
+		t = d;
+		d = c;
+		c = b;
+		b = b + rol32(a + f + md5K[i] + m[g], md5R[i]);
+		a = t;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+}
+
+
+/* SHA-256 (FIPS 180-4) */
+
+static const uint32_t sha256K[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t ror32(uint32_t x, int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+static void sha256_block(uint32_t *state, const uint8_t *blk)
+{
+	uint32_t w[64];
+	uint32_t a, b, c, d, e, f, g, h;
+	uint32_t t1, t2;
+	int i;
+
+	for (i=0; i<16; i++)
+	{
+		w[i] = ((uint32_t)blk[i * 4] << 24) | (blk[i * 4 + 1] << 16) | (blk[i * 4 + 2] << 8) | blk[i * 4 + 3];
+	}
+	for (i=16; i<64; i++)
+	{
+		w[i] = w[i - 16] + (ror32(w[i - 15], 7) ^ ror32(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+		       w[i - 7]  + (ror32(w[i - 2], 17) ^ ror32(w[i - 2], 19) ^ (w[i - 2] >> 10));
+	}
+
+	a = state[0]; b = state[1]; c = state[2]; d = state[3];
+	e = state[4]; f = state[5]; g = state[6]; h = state[7];
+	for (i=0; i<64; i++)
+	{
+		t1 = h + (ror32(e, 6) ^ ror32(e, 11) ^ ror32(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+		t2 = (ror32(a, 2) ^ ror32(a, 13) ^ ror32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+
+/* XXH64 */
+
+#define XXH_P1 (0x9E3779B185EBCA87ULL)
+#define XXH_P2 (0xC2B2AE3D27D4EB4FULL)
+#define XXH_P3 (0x165667B19E3779F9ULL)
+#define XXH_P4 (0x85EBCA77C2B2AE63ULL)
+#define XXH_P5 (0x27D4EB2F165667C5ULL)
+
+static inline uint64_t rol64(uint64_t x, int n)
+{
+	return (x << n) | (x >> (64 - n));
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le64_to_cpu(v);
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le32_to_cpu(v);
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * XXH_P2;
+	acc  = rol64(acc, 31);
+	return acc * XXH_P1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t h, uint64_t acc)
+{
+	h ^= xxh64_round(0, acc);
+	return h * XXH_P1 + XXH_P4;
+}
+
+static void xxh64_block(uint64_t *acc, const uint8_t *blk)
+{
+	acc[0] = xxh64_round(acc[0], read64(blk));
+	acc[1] = xxh64_round(acc[1], read64(blk + 8));
+	acc[2] = xxh64_round(acc[2], read64(blk + 16));
+	acc[3] = xxh64_round(acc[3], read64(blk + 24));
+}
+
+static uint64_t xxh64_final(struct file_hash *hs)
+{
+	const uint64_t *acc = hs->xxh64.acc;
+	const uint8_t  *p   = hs->xxh64.buf;
+	size_t rest = hs->xxh64.len & 31;
+	uint64_t h;
+
+	if (hs->xxh64.len >= 32)
+	{
+		h = rol64(acc[0], 1) + rol64(acc[1], 7) + rol64(acc[2], 12) + rol64(acc[3], 18);
+		h = xxh64_merge(h, acc[0]);
+		h = xxh64_merge(h, acc[1]);
+		h = xxh64_merge(h, acc[2]);
+		h = xxh64_merge(h, acc[3]);
+	}
+	else
+	{
+		/* Seed 0 */
+		h = XXH_P5;
+	}
+	h += hs->xxh64.len;
+
+	while (rest >= 8)
+	{
+		h ^= xxh64_round(0, read64(p));
+		h  = rol64(h, 27) * XXH_P1 + XXH_P4;
+		p += 8;
+		rest -= 8;
+	}
+	if (rest >= 4)
+	{
+		h ^= (uint64_t)read32(p) * XXH_P1;
+		h  = rol64(h, 23) * XXH_P2 + XXH_P3;
+		p += 4;
+		rest -= 4;
+	}
+	while (rest > 0)
+	{
+		h ^= (*p) * XXH_P5;
+		h  = rol64(h, 11) * XXH_P1;
+		p++;
+		rest--;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_P2;
+	h ^= h >> 29;
+	h *= XXH_P3;
+	h ^= h >> 32;
+	return h;
+}
+
+
+/**
+ * Add data to a 64 bytes block hash (MD5, SHA-256)
+ */
+static void hash_update64(uint32_t *state, uint64_t *total, uint8_t *buf,
+			  const uint8_t *data, size_t len,
+			  void (*block)(uint32_t *, const uint8_t *))
+{
+	size_t used = (*total) & 63;
+	size_t n;
+
+	(*total) += len;
+	if (used)
+	{
+		n = (len < 64 - used) ? len : (64 - used);
+		memcpy(buf + used, data, n);
+		data += n;
+		len  -= n;
+		if (used + n < 64)
+		{
+			return;
+		}
+		block(state, buf);
+	}
+	for (; len >= 64; data += 64, len -= 64)
+	{
+		block(state, data);
+	}
+	memcpy(buf, data, len);
+}
+
+/**
+ * Padding of MD5 (length little endian) and SHA-256 (big endian)
+ */
+static void hash_final64(uint32_t *state, uint64_t total, uint8_t *buf,
+			 int bigEndian, void (*block)(uint32_t *, const uint8_t *))
+{
+	size_t used = total & 63;
+	uint64_t bits = total * 8;
+	int i;
+
+	buf[used++] = 0x80;
+	if (used > 56)
+	{
+		memset(buf + used, 0, 64 - used);
+		block(state, buf);
+		used = 0;
+	}
+	memset(buf + used, 0, 56 - used);
+	for (i=0; i<8; i++)
+	{
+		buf[56 + i] = bigEndian ? (bits >> (56 - 8 * i)) : (bits >> (8 * i));
+	}
+	block(state, buf);
+}
+
+/**
+ * Allocate the digests of a file
+ * Return NULL if out of memory
+ */
+struct file_hash *file_hash_new(void)
+{
+	static const uint32_t md5Init[4] =
+	{
+		0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+	};
+	static const uint32_t sha256Init[8] =
+	{
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	struct file_hash *hs;
+
+	hs = calloc(1, sizeof(*hs));
+	if (hs == NULL)
+	{
+		return NULL;
+	}
+	memcpy(hs->md5.state, md5Init, sizeof(md5Init));
+	memcpy(hs->sha256.state, sha256Init, sizeof(sha256Init));
+	hs->xxh64.acc[0] = XXH_P1 + XXH_P2;
+	hs->xxh64.acc[1] = XXH_P2;
+	hs->xxh64.acc[2] = 0;
+	hs->xxh64.acc[3] = -XXH_P1;
+	return hs;
+}
+
+/**
+ * Free the digests of a file
+ */
+void file_hash_free(struct file_hash *hs)
+{
+	free(hs);
+}
+
+/**
+ * Add the next bytes of the file
+ */
+void file_hash_update(struct file_hash *hs, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	size_t used;
+	size_t n;
+
+	if (hashAlgos & HASH_MD5)
+	{
+		hash_update64(hs->md5.state, &hs->md5.len, hs->md5.buf, data, len, md5_block);
+	}
+	if (hashAlgos & HASH_SHA256)
+	{
+		hash_update64(hs->sha256.state, &hs->sha256.len, hs->sha256.buf, data, len, sha256_block);
+	}
+	if (hashAlgos & HASH_XXH64)
+	{
+		used = hs->xxh64.len & 31;
+		hs->xxh64.len += len;
+		if (used)
+		{
+			n = (len < 32 - used) ? len : (32 - used);
+			memcpy(hs->xxh64.buf + used, p, n);
+			p   += n;
+			len -= n;
+			if (used + n < 32)
+			{
+				return;
+			}
+			xxh64_block(hs->xxh64.acc, hs->xxh64.buf);
+		}
+		for (; len >= 32; p += 32, len -= 32)
+		{
+			xxh64_block(hs->xxh64.acc, p);
+		}
+		memcpy(hs->xxh64.buf, p, len);
+	}
+}
+
+/**
+ * End the digests, set the hexadecimal strings (once)
+ */
+void file_hash_final(struct file_hash *hs)
+{
+	uint8_t digest[32];
+	int i;
+
+	if (hs->finalized)
+	{
+		return;
+	}
+	hs->finalized = 1;
+
+	if (hashAlgos & HASH_MD5)
+	{
+		hash_final64(hs->md5.state, hs->md5.len, hs->md5.buf, 0, md5_block);
+		for (i=0; i<16; i++)
+		{
+			digest[i] = hs->md5.state[i / 4] >> (8 * (i % 4));
+		}
+		for (i=0; i<16; i++)
+		{
+			sprintf(hs->md5Hex + 2 * i, "%02x", digest[i]);
+		}
+	}
+	if (hashAlgos & HASH_SHA256)
+	{
+		hash_final64(hs->sha256.state, hs->sha256.len, hs->sha256.buf, 1, sha256_block);
+		for (i=0; i<32; i++)
+		{
+			digest[i] = hs->sha256.state[i / 4] >> (24 - 8 * (i % 4));
+		}
+		for (i=0; i<32; i++)
+		{
+			sprintf(hs->sha256Hex + 2 * i, "%02x", digest[i]);
+		}
+	}
+	if (hashAlgos & HASH_XXH64)
+	{
+		sprintf(hs->xxh64Hex, "%016llx", (unsigned long long)xxh64_final(hs));
+	}
+}
+
+/**
+ * Print the digests like md5sum, sha256sum and xxhsum
+ */
+void file_hash_print(FILE *out, const struct file_hash *hs, const char *path)
+{
+	if (hashAlgos & HASH_MD5)
+	{
+		fprintf(out, "%s  %s\n", hs->md5Hex, path);
+	}
+	if (hashAlgos & HASH_SHA256)
+	{
+		fprintf(out, "%s  %s\n", hs->sha256Hex, path);
+	}
+	if (hashAlgos & HASH_XXH64)
+	{
+		fprintf(out, "%s  %s\n", hs->xxh64Hex, path);
+	}
+}
+
+/**
+ * Return the hexadecimal digest of an algorithm (index in the manifest tables)
+ */
+static const char *file_hash_hex(const struct file_hash *hs, int algo)
+{
+	switch (algo)
+	{
+		case 0:
+			return hs->md5Hex;
+		case 1:
+			return hs->sha256Hex;
+		default:
+			return hs->xxh64Hex;
+	}
+}
+
+/**
+ * Add the digests of a file to the manifests (opened at the first file)
+ * One algorithm: manifestFile, else one manifest per algorithm
+ */
+void file_hash_manifest_add(const struct file_hash *hs, const char *path)
+{
+	int i;
+
+	if ( (manifestFile == NULL) || (hashAlgos == 0) )
+	{
+		return;
+	}
+	for (i=0; i<HASH_NB_ALGOS; i++)
+	{
+		if (!(hashAlgos & (1 << i)))
+		{
+			continue;
+		}
+		if (manifest[i] == NULL)
+		{
+			if (hashAlgos == (1 << i))
+			{
+				snprintf(manifestName[i], sizeof(manifestName[i]), "%s", manifestFile);
+			}
+			else
+			{
+				snprintf(manifestName[i], sizeof(manifestName[i]), "%s.%s", manifestFile, hashSuffix[i]);
+			}
+			manifest[i] = fopen(manifestName[i], "w");
+			if (manifest[i] == NULL)
+			{
+				printf("%s: Unable to open %s\n", __FUNCTION__, manifestName[i]);
+				file_hash_manifest_close();
+				manifestFile = NULL;
+				return;
+			}
+		}
+		fprintf(manifest[i], "%s (%s) = %s\n", hashTag[i], path, file_hash_hex(hs, i));
+	}
+}
+
+/**
+ * Close the manifests
+ */
+void file_hash_manifest_close(void)
+{
+	int i;
+
+	for (i=0; i<HASH_NB_ALGOS; i++)
+	{
+		if (manifest[i] == NULL)
+		{
+			continue;
+		}
+		if (fclose(manifest[i]))
+		{
+			printf("%s: Unable to write %s\n", __FUNCTION__, manifestName[i]);
+		}
+		else
+		{
+			printf("Checksum manifest: %s\n", manifestName[i]);
+		}
+		manifest[i] = NULL;
+	}
+}
@@ -64,6 +64,8 @@
 #include "defs.h"
 #include "debug.h"
 
+#include "ads_dump.h"
+
 /**
  * ubifs_ro_mode - switch UBIFS to read read-only mode.
  * @c: UBIFS file-system description object
@@ -85,35 +87,134 @@ void ubifs_ro_mode(struct ubifs_info *c, int err)
  * for more information.
  */
 
-int ubifs_leb_read(const struct ubifs_info *c, int lnum, void *buf, int offs,
-		   int len, int even_ebadmsg)
+/**
+ * ubifs_read_ctx_init - initialize a per-thread read context.
+ * @c: UBIFS file-system description object
+ * @ctx: context to initialize
+ *
+ * Each thread reading the volume owns its context, the device file
+ * descriptor is shared: reads are positional and do not move its offset.
+ */
+void ubifs_read_ctx_init(const struct ubifs_info *c, struct ubifs_read_ctx *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->fd = c->dev_fd;
+}
+
+/**
+ * ubifs_leb_read_dev - read a LEB range from the device.
+ * @c: UBIFS file-system description object
+ * @ctx: read context of the calling thread
+ * @lnum: LEB number
+ * @buf: buffer to read to
+ * @offs: offset in the LEB
+ * @len: how many bytes to read
+ *
+ * Returns zero in case of success and a negative error code otherwise,
+ * %-EIO is not converted.
+ */
+static int ubifs_leb_read_dev(const struct ubifs_info *c,
+			      struct ubifs_read_ctx *ctx, int lnum, void *buf,
+			      int offs, int len)
 {
 	int err = 0;
 	off64_t pos = (off64_t)lnum * c->leb_size + offs;
+	ssize_t done = 0;
+	ssize_t ret;
 
-	if (!len)
-		return 0;
+	/* No UBI: read the LEB through the PEB/LEB table */
+	if (peb_leb_is_raw()) {
+		err = peb_leb_read_leb(lnum, buf, offs, len);
+		/* Like %-EBADMSG in ubifs_leb_read_r: no stale data in @buf */
+		if (err)
+			memset(buf, 0xFF, len);
+		return err;
+	}
+
+	/* Positional read: no lseek, the fd may be shared between threads */
+	while (done < len) {
+		ret = pread64(ctx->fd, (char *)buf + done, len - done, pos + done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			err = -errno;
+			break;
+		}
+		if (ret == 0) {
+			err = -EIO;
+			break;
+		}
+		done += ret;
+	}
 
 	/*
 	 * The %-EBADMSG may be ignored in some case, the buf may not be filled
 	 * with data in some buggy mtd drivers. So we'd better to reset the buf
-	 * content before reading.
+	 * content on error.
 	 */
-	memset(buf, 0, len);
-	if (lseek64(c->dev_fd, pos, SEEK_SET) != pos) {
-		err = -errno;
-		goto out;
-	}
+	if (err)
+		memset(buf, 0, len);
+	return err;
+}
 
-	if (read(c->dev_fd, buf, len) != len)
-		err = -errno;
+/**
+ * ubifs_leb_read_r - reentrant version of ubifs_leb_read.
+ * @c: UBIFS file-system description object
+ * @ctx: read context of the calling thread
+ * @lnum: LEB number
+ * @buf: buffer to read to
+ * @offs: offset in the LEB
+ * @len: how many bytes to read
+ * @even_ebadmsg: print the error message even on %-EBADMSG
+ *
+ * Does not change @c, so several threads may call it at the same time with
+ * their own @ctx. The read goes through the LEB cache if it is enabled, and
+ * fails at once if it contains a page which failed too many times.
+ * Returns zero in case of success and a negative error code otherwise.
+ * On %-EBADMSG @buf is filled with 0xFF.
+ */
+int ubifs_leb_read_r(const struct ubifs_info *c, struct ubifs_read_ctx *ctx,
+		     int lnum, void *buf, int offs, int len, int even_ebadmsg)
+{
+	int err;
+	unsigned long long start;
+
+	if (!len)
+		return 0;
+
+	ctx->reads += 1;
+	start = io_stats_begin();
+
+	/* Range with a page known as unreadable: fail without reading */
+	if (bad_pages_is_bad(lnum, offs, len)) {
+		err = -EIO;
+	} else {
+		if (leb_cache_is_enabled())
+			err = leb_cache_read(c, ctx, lnum, buf, offs, len,
+					     ubifs_leb_read_dev);
+		else
+			err = ubifs_leb_read_dev(c, ctx, lnum, buf, offs, len);
+
+		if (err == -EIO || err == -EBADMSG)
+			bad_pages_record(c, ctx, lnum, offs, len, err,
+					 ubifs_leb_read_dev);
+	}
+	io_stats_end(IO_STATS_LEB_READ, start, lnum, len, err);
 
 	if (err == -EIO)
 	{
 		err = -EBADMSG;
 		memset(buf, 0xFF, len);
 	}
-out:
+	if (err) {
+		ctx->errors += 1;
+		ctx->last_err  = err;
+		ctx->last_lnum = lnum;
+		ctx->last_offs = offs;
+	} else {
+		ctx->bytes += len;
+	}
+
 	/*
 	 * In case of %-EBADMSG print the error message only if the
 	 * @even_ebadmsg is true.
@@ -126,6 +227,15 @@ out:
 	return err;
 }
 
+int ubifs_leb_read(const struct ubifs_info *c, int lnum, void *buf, int offs,
+		   int len, int even_ebadmsg)
+{
+	struct ubifs_read_ctx ctx;
+
+	ubifs_read_ctx_init(c, &ctx);
+	return ubifs_leb_read_r(c, &ctx, lnum, buf, offs, len, even_ebadmsg);
+}
+
 int ubifs_leb_write(struct ubifs_info *c, int lnum, const void *buf, int offs,
 		    int len)
 {
@@ -243,6 +353,8 @@ int ubifs_is_mapped(const struct ubifs_info *c, int lnum)
 {
 	int err = 0;
 
+	if (peb_leb_is_raw())
+		return peb_leb_is_mapped(lnum);
 	if (!c->libubi)
 		return -ENODEV;
 	if (ubi_is_mapped(c->dev_fd, lnum))
@@ -290,6 +402,7 @@ int ubifs_check_node(const struct ubifs_info *c, const void *buf, int len,
 	int err = -EINVAL, type, node_len;
 	uint32_t crc, node_crc, magic;
 	const struct ubifs_ch *ch = buf;
+	unsigned long long start;
 
 	ubifs_assert(c, lnum >= 0 && lnum < c->leb_cnt && offs >= 0);
 	ubifs_assert(c, !(offs & 7) && offs < c->leb_size);
@@ -325,8 +438,11 @@ int ubifs_check_node(const struct ubifs_info *c, const void *buf, int len,
 	    !c->remounting_rw && c->no_chk_data_crc)
 		return 0;
 
-	crc = crc32(UBIFS_CRC32_INIT, buf + 8, node_len - 8);
+	start = io_stats_begin();
+	crc = crc32_fast(UBIFS_CRC32_INIT, buf + 8, node_len - 8);
 	node_crc = le32_to_cpu(ch->crc);
+	io_stats_end(IO_STATS_CHECK_NODE, start, lnum, node_len,
+		     crc != node_crc);
 	if (crc != node_crc) {
 		if (!quiet)
 			ubifs_err(c, "bad CRC: calculated %#08x, read %#08x",
@@ -383,7 +499,7 @@ void ubifs_pad(const struct ubifs_info *c, void *buf, int pad)
 		ch->len = cpu_to_le32(UBIFS_PAD_NODE_SZ);
 		pad -= UBIFS_PAD_NODE_SZ;
 		pad_node->pad_len = cpu_to_le32(pad);
-		crc = crc32(UBIFS_CRC32_INIT, buf + 8, UBIFS_PAD_NODE_SZ - 8);
+		crc = crc32_fast(UBIFS_CRC32_INIT, buf + 8, UBIFS_PAD_NODE_SZ - 8);
 		ch->crc = cpu_to_le32(crc);
 		memset(buf + UBIFS_PAD_NODE_SZ, 0, pad);
 	} else if (pad > 0)
@@ -997,6 +1113,40 @@ out:
 	return -EINVAL;
 }
 
+/**
+ * ubifs_map_node - access a node of a memory mapped image without copy.
+ * @c: UBIFS file-system description object
+ * @type: node type
+ * @len: node length
+ * @lnum: logical eraseblock number
+ * @offs: offset within the logical eraseblock
+ *
+ * The node is checked (type, CRC, length) like ubifs_read_node but quietly.
+ * Returns a read-only pointer to the node inside the image, or %NULL if the
+ * volume is not a mapped image or the node is not valid: the caller then
+ * uses ubifs_read_node, which reports the error.
+ */
+const void *ubifs_map_node(const struct ubifs_info *c, int type, int len,
+			   int lnum, int offs)
+{
+	const struct ubifs_ch *ch;
+
+	if (len < UBIFS_CH_SZ || offs < 0 || offs + len > c->leb_size)
+		return NULL;
+
+	ch = peb_leb_map_leb(lnum, offs, len);
+	if (!ch)
+		return NULL;
+
+	if (ch->node_type != type || le32_to_cpu(ch->len) != len)
+		return NULL;
+
+	if (ubifs_check_node(c, ch, len, lnum, offs, 1, 1))
+		return NULL;
+
+	return ch;
+}
+
 /**
  * ubifs_read_node - read node.
  * @c: UBIFS file-system description object
@@ -1010,8 +1160,8 @@ out:
  * stores in @buf. Returns zero in case of success, %-EUCLEAN if CRC mismatched
  * and a negative error code in case of failure.
  */
-int ubifs_read_node(const struct ubifs_info *c, void *buf, int type, int len,
-		    int lnum, int offs)
+static int __ubifs_read_node(const struct ubifs_info *c, void *buf, int type,
+			     int len, int lnum, int offs)
 {
 	int err, l;
 	struct ubifs_ch *ch = buf;
@@ -1050,12 +1200,23 @@ int ubifs_read_node(const struct ubifs_info *c, void *buf, int type, int len,
 out:
 	set_failure_reason_callback(c, FR_DATA_CORRUPTED);
 	ubifs_err(c, "bad node at LEB %d:%d, LEB mapping status %d", lnum,
-		  offs, ubi_is_mapped(c->dev_fd, lnum));
+		  offs, ubifs_is_mapped(c, lnum));
 	ubifs_dump_node(c, buf, len);
 	dump_stack();
 	return -EINVAL;
 }
 
+int ubifs_read_node(const struct ubifs_info *c, void *buf, int type, int len,
+		    int lnum, int offs)
+{
+	unsigned long long start = io_stats_begin();
+	int err;
+
+	err = __ubifs_read_node(c, buf, type, len, lnum, offs);
+	io_stats_end(IO_STATS_READ_NODE, start, lnum, len, err);
+	return err;
+}
+
 /**
  * ubifs_wbuf_init - initialize write-buffer.
  * @c: UBIFS file-system description object
@@ -0,0 +1,292 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * This file is part of UBIFS.
+ *
+ * Copyright (C) 2025 AIRBUS Defence & Space
+ *
+ * Authors: Frederic Fraysse
+ */
+
+/*
+ * Statistics of the I/O layer: number of calls, bytes, errors and a
+ * log2 histogram of the time of ubifs_leb_read, ubifs_read_node and of
+ * the CRC check of ubifs_check_node, with a breakdown per LEB.
+ * Printed, or written as JSON, at exit.
+ * When disabled, io_stats_begin returns 0 without reading the clock and
+ * io_stats_end returns at once.
+ */
+
+#include "ads_dump.h"
+
+#include <pthread.h>
+#include <time.h>
+
+
+/* Number of buckets of the histograms: bucket i holds [2^i, 2^(i+1)) ns */
+#define IO_STATS_BUCKETS (40)
+
+/* Statistics of one operation */
+struct io_stats_op_info
+{
+	unsigned long long calls;
+	unsigned long long bytes;
+	unsigned long long errors;
+	unsigned long long totalNs;
+	unsigned long long maxNs;
+	unsigned long long histo[IO_STATS_BUCKETS];
+};
+
+/* Statistics of one LEB (ubifs_leb_read only) */
+struct io_stats_leb
+{
+	unsigned long long reads;
+	unsigned long long bytes;
+	unsigned long long errors;
+	unsigned long long totalNs;
+};
+
+static const char *opName[IO_STATS_OPS] =
+{
+	[IO_STATS_LEB_READ]   = "leb_read",
+	[IO_STATS_READ_NODE]  = "read_node",
+	[IO_STATS_CHECK_NODE] = "check_node_crc",
+};
+
+/* 0: disabled */
+static int statsEnabled = 0;
+
+/* JSON file to write, NULL: print */
+static const char *jsonFile = NULL;
+
+static struct io_stats_op_info ops[IO_STATS_OPS];
+
+/* Per LEB statistics, grown on demand */
+static struct io_stats_leb *lebStats = NULL;
+static int lebStatsNumber = 0;
+
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * Enable the statistics
+ * file: JSON file written at exit, NULL to print them
+ */
+void io_stats_set(int enable, const char *file)
+{
+	statsEnabled = enable;
+	jsonFile     = file;
+}
+
+/**
+ * Return the time to give to io_stats_end, 0 if disabled
+ */
+unsigned long long io_stats_begin(void)
+{
+	struct timespec ts;
+
+	if (__builtin_expect(!statsEnabled, 1))
+	{
+		return 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Account one operation started at start (io_stats_begin)
+ * lnum: LEB of the operation, -1 if none
+ */
+void io_stats_end(enum io_stats_op op, unsigned long long start, int lnum, int len, int err)
+{
+	struct io_stats_op_info *o;
+	struct io_stats_leb *grown;
+	unsigned long long ns;
+	int bucket;
+	int newNumber;
+
+	if (__builtin_expect(!statsEnabled || (start == 0), 1))
+	{
+		return;
+	}
+
+	ns     = io_stats_begin() - start;
+	bucket = (ns > 1) ? (63 - __builtin_clzll(ns)) : 0;
+	if (bucket >= IO_STATS_BUCKETS)
+	{
+		bucket = IO_STATS_BUCKETS - 1;
+	}
+
+	pthread_mutex_lock(&statsLock);
+	o = &ops[op];
+	o->calls++;
+	o->totalNs += ns;
+	o->histo[bucket]++;
+	if (ns > o->maxNs)
+	{
+		o->maxNs = ns;
+	}
+	if (err)
+	{
+		o->errors++;
+	}
+	else
+	{
+		o->bytes += len;
+	}
+
+	if ( (op == IO_STATS_LEB_READ) && (lnum >= 0) )
+	{
+		if (lnum >= lebStatsNumber)
+		{
+			newNumber = (lnum + 1 > 2 * lebStatsNumber) ? (lnum + 1) : (2 * lebStatsNumber);
+			grown = realloc(lebStats, newNumber * sizeof(*lebStats));
+			if (grown != NULL)
+			{
+				memset(grown + lebStatsNumber, 0, (newNumber - lebStatsNumber) * sizeof(*lebStats));
+				lebStats       = grown;
+				lebStatsNumber = newNumber;
+			}
+		}
+		if (lnum < lebStatsNumber)
+		{
+			lebStats[lnum].reads++;
+			lebStats[lnum].totalNs += ns;
+			if (err)
+			{
+				lebStats[lnum].errors++;
+			}
+			else
+			{
+				lebStats[lnum].bytes += len;
+			}
+		}
+	}
+	pthread_mutex_unlock(&statsLock);
+}
+
+/**
+ * Print the statistics
+ */
+static void io_stats_print_text(void)
+{
+	struct io_stats_op_info *o;
+	int op, i;
+
+	printf("I/O statistics:\n");
+	for (op=0; op<IO_STATS_OPS; op++)
+	{
+		o = &ops[op];
+		printf("%-15s calls:%llu bytes:%llu errors:%llu total:%.3fms mean:%.1fus max:%.1fus\n",
+				opName[op],
+				o->calls,
+				o->bytes,
+				o->errors,
+				o->totalNs / 1e6,
+				o->calls ? (o->totalNs / 1e3 / o->calls) : 0.0,
+				o->maxNs / 1e3);
+		for (i=0; i<IO_STATS_BUCKETS; i++)
+		{
+			if (o->histo[i])
+			{
+				printf("    [%.1fus, %.1fus) %llu\n",
+						(1ULL << i) / 1e3,
+						(1ULL << (i + 1)) / 1e3,
+						o->histo[i]);
+			}
+		}
+	}
+
+	printf("Per LEB reads:\n");
+	for (i=0; i<lebStatsNumber; i++)
+	{
+		if (lebStats[i].reads)
+		{
+			printf("    LEB %d (PEB %d) reads:%llu bytes:%llu errors:%llu total:%.3fms\n",
+					i,
+					peb_leb_getPeb(i),
+					lebStats[i].reads,
+					lebStats[i].bytes,
+					lebStats[i].errors,
+					lebStats[i].totalNs / 1e6);
+		}
+	}
+}
+
+/**
+ * Write the statistics as JSON
+ */
+static void io_stats_write_json(void)
+{
+	struct io_stats_op_info *o;
+	FILE *fd;
+	int op, i;
+	int first;
+
+	fd = fopen(jsonFile, "w");
+	if (fd == NULL)
+	{
+		printf("%s: Unable to open %s\n", __FUNCTION__, jsonFile);
+		return;
+	}
+
+	fprintf(fd, "{\n  \"ops\": {\n");
+	for (op=0; op<IO_STATS_OPS; op++)
+	{
+		o = &ops[op];
+		fprintf(fd, "    \"%s\": {\"calls\": %llu, \"bytes\": %llu, \"errors\": %llu, \"total_ns\": %llu, \"max_ns\": %llu, \"histo_log2_ns\": [",
+				opName[op],
+				o->calls,
+				o->bytes,
+				o->errors,
+				o->totalNs,
+				o->maxNs);
+		for (i=0; i<IO_STATS_BUCKETS; i++)
+		{
+			fprintf(fd, "%s%llu", i ? ", " : "", o->histo[i]);
+		}
+		fprintf(fd, "]}%s\n", (op + 1 < IO_STATS_OPS) ? "," : "");
+	}
+	fprintf(fd, "  },\n  \"lebs\": [");
+
+	first = 1;
+	for (i=0; i<lebStatsNumber; i++)
+	{
+		if (lebStats[i].reads)
+		{
+			fprintf(fd, "%s\n    {\"lnum\": %d, \"pnum\": %d, \"reads\": %llu, \"bytes\": %llu, \"errors\": %llu, \"total_ns\": %llu}",
+					first ? "" : ",",
+					i,
+					peb_leb_getPeb(i),
+					lebStats[i].reads,
+					lebStats[i].bytes,
+					lebStats[i].errors,
+					lebStats[i].totalNs);
+			first = 0;
+		}
+	}
+	fprintf(fd, "\n  ]\n}\n");
+	fclose(fd);
+	printf("I/O statistics written to %s\n", jsonFile);
+}
+
+/**
+ * Print or write the statistics, if enabled
+ */
+void io_stats_print(void)
+{
+	if (!statsEnabled)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&statsLock);
+	if (jsonFile != NULL)
+	{
+		io_stats_write_json();
+	}
+	else
+	{
+		io_stats_print_text();
+	}
+	pthread_mutex_unlock(&statsLock);
+}
@@ -0,0 +1,421 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * This file is part of UBIFS.
+ *
+ * Copyright (C) 2025 AIRBUS Defence & Space
+ *
+ * Authors: Frederic Fraysse
+ */
+
+/*
+ * Asynchronous LEB reads with io_uring (raw system calls, no liburing).
+ * The caller queues several reads with leb_aio_submit and gets them back,
+ * in completion order, with leb_aio_complete.
+ *
+ * The reads are done synchronously (ubifs_leb_read_r) when:
+ *  - io_uring is not enabled or not available (old kernel, seccomp...)
+ *  - the volume is read without UBI (PEB/LEB table)
+ *  - the LEB cache is enabled
+ * A read in error or short is redone synchronously, to keep the EBADMSG
+ * handling of ubifs_leb_read and the recording of the bad pages. A read of
+ * a known bad page fails at once, synchronously. The reads done by io_uring
+ * are counted in the I/O statistics like the synchronous ones.
+ */
+
+#include "ads_dump.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup (425)
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter (426)
+#endif
+
+
+/* Use io_uring if available */
+static int aioEnabled = 0;
+
+/* Queue of reads of one thread */
+struct leb_aio
+{
+	const struct ubifs_info *c;
+
+	/* Context of the synchronous reads */
+	struct ubifs_read_ctx ctx;
+
+	/* Maximum number of reads in the queue */
+	unsigned depth;
+
+	/* io_uring, -1: synchronous */
+	int ringFd;
+
+	/* Submission ring */
+	void     *sqRing;
+	size_t    sqRingSize;
+	unsigned *sqHead;
+	unsigned *sqTail;
+	unsigned *sqMask;
+	unsigned *sqArray;
+	struct io_uring_sqe *sqes;
+	size_t    sqesSize;
+
+	/* Completion ring (may be the same mapping as sqRing) */
+	void     *cqRing;
+	size_t    cqRingSize;
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned *cqMask;
+	struct io_uring_cqe *cqes;
+
+	/* Reads queued in the SQ ring, not yet given to the kernel */
+	unsigned toSubmit;
+
+	/* Reads given to the kernel, not yet completed */
+	unsigned inFlight;
+
+	/* Reads done synchronously, waiting for leb_aio_complete */
+	struct leb_aio_req **done;
+	unsigned doneHead;
+	unsigned doneCount;
+};
+
+
+/**
+ * Use io_uring for the reads queued with leb_aio_submit
+ * Call before leb_aio_open
+ */
+void leb_aio_set_enabled(int enable)
+{
+	aioEnabled = enable;
+}
+
+static int leb_aio_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int leb_aio_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+/**
+ * Release the io_uring of the queue, the queue becomes synchronous
+ */
+static void leb_aio_ring_free(struct leb_aio *aio)
+{
+	if ( (aio->cqRing != NULL) && (aio->cqRing != aio->sqRing) )
+	{
+		munmap(aio->cqRing, aio->cqRingSize);
+	}
+	if (aio->sqRing != NULL)
+	{
+		munmap(aio->sqRing, aio->sqRingSize);
+	}
+	if (aio->sqes != NULL)
+	{
+		munmap(aio->sqes, aio->sqesSize);
+	}
+	if (aio->ringFd >= 0)
+	{
+		close(aio->ringFd);
+	}
+	aio->sqRing = NULL;
+	aio->cqRing = NULL;
+	aio->sqes   = NULL;
+	aio->ringFd = -1;
+}
+
+/**
+ * Create the io_uring and map its rings
+ * Return 0 or -1 (the queue stays synchronous)
+ */
+static int leb_aio_ring_init(struct leb_aio *aio)
+{
+	struct io_uring_params p;
+	uint8_t *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	aio->ringFd = leb_aio_setup(aio->depth, &p);
+	if (aio->ringFd < 0)
+	{
+		printf("%s: io_uring not available (%s), synchronous reads\n", __FUNCTION__, strerror(errno));
+		aio->ringFd = -1;
+		return -1;
+	}
+
+	aio->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	aio->cqRingSize = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (aio->cqRingSize > aio->sqRingSize)
+		{
+			aio->sqRingSize = aio->cqRingSize;
+		}
+		aio->cqRingSize = aio->sqRingSize;
+	}
+
+	aio->sqRing = mmap(NULL, aio->sqRingSize, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, aio->ringFd, IORING_OFF_SQ_RING);
+	if (aio->sqRing == MAP_FAILED)
+	{
+		aio->sqRing = NULL;
+		goto error;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		aio->cqRing = aio->sqRing;
+	}
+	else
+	{
+		aio->cqRing = mmap(NULL, aio->cqRingSize, PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_POPULATE, aio->ringFd, IORING_OFF_CQ_RING);
+		if (aio->cqRing == MAP_FAILED)
+		{
+			aio->cqRing = NULL;
+			goto error;
+		}
+	}
+
+	aio->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+	aio->sqes = mmap(NULL, aio->sqesSize, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, aio->ringFd, IORING_OFF_SQES);
+	if (aio->sqes == MAP_FAILED)
+	{
+		aio->sqes = NULL;
+		goto error;
+	}
+
+	sq = aio->sqRing;
+	cq = aio->cqRing;
+	aio->sqHead  = (unsigned *)(sq + p.sq_off.head);
+	aio->sqTail  = (unsigned *)(sq + p.sq_off.tail);
+	aio->sqMask  = (unsigned *)(sq + p.sq_off.ring_mask);
+	aio->sqArray = (unsigned *)(sq + p.sq_off.array);
+	aio->cqHead  = (unsigned *)(cq + p.cq_off.head);
+	aio->cqTail  = (unsigned *)(cq + p.cq_off.tail);
+	aio->cqMask  = (unsigned *)(cq + p.cq_off.ring_mask);
+	aio->cqes    = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+
+error:
+	printf("%s: io_uring mmap error (%s), synchronous reads\n", __FUNCTION__, strerror(errno));
+	leb_aio_ring_free(aio);
+	return -1;
+}
+
+/**
+ * Create a queue of reads, to be used by one thread
+ * depth: maximum number of reads queued
+ * Return NULL on allocation error
+ */
+struct leb_aio *leb_aio_open(const struct ubifs_info *c, unsigned depth)
+{
+	struct leb_aio *aio;
+
+	if (depth == 0)
+	{
+		depth = 1;
+	}
+
+	aio = calloc(1, sizeof(*aio));
+	if (aio == NULL)
+	{
+		return NULL;
+	}
+	aio->done = calloc(depth, sizeof(*aio->done));
+	if (aio->done == NULL)
+	{
+		free(aio);
+		return NULL;
+	}
+	aio->c      = c;
+	aio->depth  = depth;
+	aio->ringFd = -1;
+	ubifs_read_ctx_init(c, &aio->ctx);
+
+	if ( aioEnabled && !peb_leb_is_raw() && !leb_cache_is_enabled() && (c->dev_fd >= 0) )
+	{
+		leb_aio_ring_init(aio);
+	}
+	return aio;
+}
+
+/**
+ * Return 1 if the reads of the queue are done by io_uring
+ */
+int leb_aio_is_async(const struct leb_aio *aio)
+{
+	return aio->ringFd >= 0;
+}
+
+/**
+ * Number of reads queued and not yet returned by leb_aio_complete
+ */
+unsigned leb_aio_pending(const struct leb_aio *aio)
+{
+	return aio->toSubmit + aio->inFlight + aio->doneCount;
+}
+
+/**
+ * Give the queued reads to the kernel
+ */
+static int leb_aio_flush(struct leb_aio *aio)
+{
+	int ret;
+
+	while (aio->toSubmit > 0)
+	{
+		ret = leb_aio_enter(aio->ringFd, aio->toSubmit, 0, 0);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return -errno;
+		}
+		aio->toSubmit -= ret;
+		aio->inFlight += ret;
+	}
+	return 0;
+}
+
+/**
+ * Queue a read of req->len bytes of LEB req->lnum at req->offs into req->buf
+ * The read is only started at the next leb_aio_complete
+ * Return 0 or -EBUSY if the queue is full (call leb_aio_complete first)
+ */
+int leb_aio_submit(struct leb_aio *aio, struct leb_aio_req *req)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx;
+
+	if (leb_aio_pending(aio) >= aio->depth)
+	{
+		return -EBUSY;
+	}
+
+	if ( (aio->ringFd < 0) || bad_pages_has_bad(req->lnum, req->offs, req->len) )
+	{
+		/* Synchronous: read now, returned by leb_aio_complete */
+		req->err = ubifs_leb_read_r(aio->c, &aio->ctx, req->lnum, req->buf, req->offs, req->len, 0);
+		aio->done[(aio->doneHead + aio->doneCount) % aio->depth] = req;
+		aio->doneCount++;
+		return 0;
+	}
+
+	req->iov.iov_base = req->buf;
+	req->iov.iov_len  = req->len;
+	req->err          = 0;
+	req->start        = io_stats_begin();
+
+	tail = *aio->sqTail;
+	idx  = tail & *aio->sqMask;
+	sqe  = &aio->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode    = IORING_OP_READV;
+	sqe->fd        = aio->ctx.fd;
+	sqe->off       = (uint64_t)req->lnum * aio->c->leb_size + req->offs;
+	sqe->addr      = (uintptr_t)&req->iov;
+	sqe->len       = 1;
+	sqe->user_data = (uintptr_t)req;
+
+	aio->sqArray[idx] = idx;
+	__atomic_store_n(aio->sqTail, tail + 1, __ATOMIC_RELEASE);
+	aio->toSubmit++;
+	return 0;
+}
+
+/**
+ * Wait for one read of the queue
+ * *req: the completed read, req->err is its result (like ubifs_leb_read)
+ * Return 1 if a read is returned, 0 if the queue is empty, or a negative error
+ */
+int leb_aio_complete(struct leb_aio *aio, struct leb_aio_req **req)
+{
+	struct io_uring_cqe *cqe;
+	struct leb_aio_req  *r;
+	unsigned head;
+	int ret;
+
+	if (aio->doneCount > 0)
+	{
+		*req = aio->done[aio->doneHead];
+		aio->doneHead = (aio->doneHead + 1) % aio->depth;
+		aio->doneCount--;
+		return 1;
+	}
+
+	if (aio->ringFd < 0)
+	{
+		return 0;
+	}
+
+	ret = leb_aio_flush(aio);
+	if (ret)
+	{
+		return ret;
+	}
+	if (aio->inFlight == 0)
+	{
+		return 0;
+	}
+
+	head = *aio->cqHead;
+	while (head == __atomic_load_n(aio->cqTail, __ATOMIC_ACQUIRE))
+	{
+		ret = leb_aio_enter(aio->ringFd, 0, 1, IORING_ENTER_GETEVENTS);
+		if ( (ret < 0) && (errno != EINTR) )
+		{
+			return -errno;
+		}
+	}
+
+	cqe = &aio->cqes[head & *aio->cqMask];
+	r   = (struct leb_aio_req *)(uintptr_t)cqe->user_data;
+	ret = cqe->res;
+	__atomic_store_n(aio->cqHead, head + 1, __ATOMIC_RELEASE);
+	aio->inFlight--;
+
+	if (ret == r->len)
+	{
+		r->err = 0;
+		aio->ctx.reads += 1;
+		aio->ctx.bytes += r->len;
+		io_stats_end(IO_STATS_LEB_READ, r->start, r->lnum, r->len, 0);
+	}
+	else
+	{
+		/* Error or short read: redo it synchronously (EIO -> EBADMSG...) */
+		r->err = ubifs_leb_read_r(aio->c, &aio->ctx, r->lnum, r->buf, r->offs, r->len, 0);
+	}
+
+	*req = r;
+	return 1;
+}
+
+/**
+ * Release the queue, the pending reads are waited for
+ */
+void leb_aio_close(struct leb_aio *aio)
+{
+	struct leb_aio_req *req;
+
+	if (aio == NULL)
+	{
+		return;
+	}
+	while (leb_aio_complete(aio, &req) > 0)
+	{
+	}
+	leb_aio_ring_free(aio);
+	free(aio->done);
+	free(aio);
+}
@@ -0,0 +1,419 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * This file is part of UBIFS.
+ *
+ * Copyright (C) 2025 AIRBUS Defence & Space
+ *
+ * Authors: Frederic Fraysse
+ */
+
+/*
+ * LRU cache of flash pages in front of the LEB reads.
+ * The nodes of a file are often stored one after the other in the same
+ * LEB: reading a chunk of pages once serves the following nodes from memory.
+ * A chunk in error (EBADMSG...) is never cached, the read is then done
+ * directly on the requested range to keep the error of the range.
+ * The bad pages of a failed chunk are recorded in the bad page map, and a
+ * chunk with a page which already failed is not read again as a whole.
+ */
+
+#include "ads_dump.h"
+
+#include <pthread.h>
+
+
+/* Minimal size of a chunk read on a miss, rounded up to min_io_size */
+#define LEB_CACHE_CHUNK_MIN (16 * 1024)
+
+/* One cached chunk of a LEB */
+struct leb_cache_entry
+{
+	int lnum;
+	/* Index of the chunk in the LEB */
+	int chunk;
+	/* Bytes in data, smaller than chunkSize for the last chunk of the LEB */
+	int len;
+
+	/* Hash collision list */
+	struct leb_cache_entry *hnext;
+
+	/* LRU list, head is the most recently used */
+	struct leb_cache_entry *prev;
+	struct leb_cache_entry *next;
+
+	uint8_t data[];
+};
+
+/* Size budget of the cache in bytes, 0: no cache */
+static long long cacheSize = 0;
+
+/* Size of a chunk, multiple of min_io_size, 0: cache not initialized */
+static int chunkSize = 0;
+
+/* Size of a LEB */
+static int lebSize = 0;
+
+/* Maximum and current number of chunks */
+static int maxEntries = 0;
+static int nbEntries  = 0;
+
+/* Hash table, hashSize is a power of 2 */
+static struct leb_cache_entry **hashTable = NULL;
+static int hashSize = 0;
+
+/* LRU list */
+static struct leb_cache_entry *lruHead = NULL;
+static struct leb_cache_entry *lruTail = NULL;
+
+/* Statistics */
+static unsigned long long hits      = 0;
+static unsigned long long misses    = 0;
+static unsigned long long evictions = 0;
+static unsigned long long bypasses  = 0;
+
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * Set the size budget of the cache (bytes), 0 to disable it
+ * Call before the first read
+ */
+void leb_cache_set_size(long long size)
+{
+	cacheSize = size;
+}
+
+/**
+ * Return 1 if the reads go through the cache
+ */
+int leb_cache_is_enabled(void)
+{
+	return cacheSize > 0;
+}
+
+/**
+ * Hash of a chunk
+ */
+static inline int leb_cache_hash(int lnum, int chunk)
+{
+	return ((unsigned int)lnum * 2654435761U + (unsigned int)chunk) & (hashSize - 1);
+}
+
+/**
+ * Allocate the hash table from the geometry of the volume
+ * Called with the lock held
+ */
+static int leb_cache_init(const struct ubifs_info *c)
+{
+	int ioSize;
+
+	ioSize = (c->min_io_size > 0) ? c->min_io_size : 1;
+
+	chunkSize = ((LEB_CACHE_CHUNK_MIN + ioSize - 1) / ioSize) * ioSize;
+	if (chunkSize > c->leb_size)
+	{
+		chunkSize = c->leb_size;
+	}
+	lebSize = c->leb_size;
+
+	maxEntries = cacheSize / chunkSize;
+	if (maxEntries < 1)
+	{
+		maxEntries = 1;
+	}
+
+	hashSize = 1;
+	while (hashSize < 2 * maxEntries)
+	{
+		hashSize <<= 1;
+	}
+	hashTable = calloc(hashSize, sizeof(*hashTable));
+	if (hashTable == NULL)
+	{
+		printf("%s: Unable to allocate the hash table\n", __FUNCTION__);
+		cacheSize = 0;
+		return -ENOMEM;
+	}
+
+	printf("Read cache: %d chunks of %d bytes\n", maxEntries, chunkSize);
+	return 0;
+}
+
+/**
+ * Remove an entry from the LRU list
+ */
+static void leb_cache_lru_unlink(struct leb_cache_entry *e)
+{
+	if (e->prev != NULL)
+	{
+		e->prev->next = e->next;
+	}
+	else
+	{
+		lruHead = e->next;
+	}
+	if (e->next != NULL)
+	{
+		e->next->prev = e->prev;
+	}
+	else
+	{
+		lruTail = e->prev;
+	}
+	e->prev = NULL;
+	e->next = NULL;
+}
+
+/**
+ * Put an entry at the head of the LRU list
+ */
+static void leb_cache_lru_push(struct leb_cache_entry *e)
+{
+	e->prev = NULL;
+	e->next = lruHead;
+	if (lruHead != NULL)
+	{
+		lruHead->prev = e;
+	}
+	lruHead = e;
+	if (lruTail == NULL)
+	{
+		lruTail = e;
+	}
+}
+
+/**
+ * Find a chunk, called with the lock held
+ */
+static struct leb_cache_entry *leb_cache_find(int lnum, int chunk)
+{
+	struct leb_cache_entry *e;
+
+	for (e = hashTable[leb_cache_hash(lnum, chunk)]; e != NULL; e = e->hnext)
+	{
+		if ( (e->lnum == lnum) && (e->chunk == chunk) )
+		{
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Remove the least recently used chunk, called with the lock held
+ */
+static void leb_cache_evict(void)
+{
+	struct leb_cache_entry **pp;
+	struct leb_cache_entry *e = lruTail;
+
+	if (e == NULL)
+	{
+		return;
+	}
+	leb_cache_lru_unlink(e);
+
+	for (pp = &hashTable[leb_cache_hash(e->lnum, e->chunk)]; *pp != NULL; pp = &(*pp)->hnext)
+	{
+		if (*pp == e)
+		{
+			*pp = e->hnext;
+			break;
+		}
+	}
+	free(e);
+	nbEntries--;
+	evictions++;
+}
+
+/**
+ * Insert a chunk read by the caller, called with the lock held
+ * Return the chunk in the cache (may be an other thread one)
+ */
+static struct leb_cache_entry *leb_cache_insert(struct leb_cache_entry *e)
+{
+	struct leb_cache_entry *old;
+	int h;
+
+	/* Already inserted by an other thread meanwhile */
+	old = leb_cache_find(e->lnum, e->chunk);
+	if (old != NULL)
+	{
+		free(e);
+		return old;
+	}
+
+	while (nbEntries >= maxEntries)
+	{
+		leb_cache_evict();
+	}
+
+	h = leb_cache_hash(e->lnum, e->chunk);
+	e->hnext     = hashTable[h];
+	hashTable[h] = e;
+	leb_cache_lru_push(e);
+	nbEntries++;
+	return e;
+}
+
+/**
+ * Read a range of a LEB through the cache
+ * reader: read of the device, used on a miss
+ * Return 0 or the error of reader for the requested range
+ */
+int leb_cache_read(const struct ubifs_info *c, struct ubifs_read_ctx *ctx,
+		   int lnum, void *buf, int offs, int len, leb_cache_reader reader)
+{
+	struct leb_cache_entry *e;
+	uint8_t *out = buf;
+	int chunk, chunkOffs, n;
+	int err;
+
+	pthread_mutex_lock(&cacheLock);
+	if ( (chunkSize == 0) && leb_cache_init(c) )
+	{
+		pthread_mutex_unlock(&cacheLock);
+		return reader(c, ctx, lnum, buf, offs, len);
+	}
+	pthread_mutex_unlock(&cacheLock);
+
+	while (len > 0)
+	{
+		chunk     = offs / chunkSize;
+		chunkOffs = offs - chunk * chunkSize;
+
+		pthread_mutex_lock(&cacheLock);
+		e = leb_cache_find(lnum, chunk);
+		if (e == NULL)
+		{
+			misses++;
+			pthread_mutex_unlock(&cacheLock);
+
+			n = lebSize - chunk * chunkSize;
+			if (n > chunkSize)
+			{
+				n = chunkSize;
+			}
+
+			/* Read the whole chunk out of the lock, except if a page of
+			 * the chunk failed: only the requested range is read */
+			e   = NULL;
+			err = -ENOMEM;
+			if (!bad_pages_has_failed(lnum, chunk * chunkSize, n))
+			{
+				e = malloc(sizeof(*e) + n);
+			}
+			if (e != NULL)
+			{
+				err = reader(c, ctx, lnum, e->data, chunk * chunkSize, n);
+				if ( (err == -EIO) || (err == -EBADMSG) )
+				{
+					/* Bad pages may be out of the requested range */
+					bad_pages_record(c, ctx, lnum, chunk * chunkSize, n, err, reader);
+				}
+			}
+			if (err != 0)
+			{
+				/* Chunk not cacheable: read only the requested range */
+				free(e);
+				pthread_mutex_lock(&cacheLock);
+				bypasses++;
+				pthread_mutex_unlock(&cacheLock);
+				return reader(c, ctx, lnum, out, offs, len);
+			}
+			e->lnum  = lnum;
+			e->chunk = chunk;
+			e->len   = n;
+
+			pthread_mutex_lock(&cacheLock);
+			e = leb_cache_insert(e);
+		}
+		else
+		{
+			hits++;
+			leb_cache_lru_unlink(e);
+			leb_cache_lru_push(e);
+		}
+
+		/* Copy under the lock: the chunk may be evicted by an other thread */
+		n = e->len - chunkOffs;
+		if (n > len)
+		{
+			n = len;
+		}
+		if (n > 0)
+		{
+			memcpy(out, e->data + chunkOffs, n);
+		}
+		pthread_mutex_unlock(&cacheLock);
+
+		/* Range out of the LEB */
+		if (n <= 0)
+		{
+			return -EINVAL;
+		}
+		out  += n;
+		offs += n;
+		len  -= n;
+	}
+	return 0;
+}
+
+/**
+ * Get the hit/miss counters of the cache
+ */
+void leb_cache_get_stats(unsigned long long *hit, unsigned long long *miss)
+{
+	pthread_mutex_lock(&cacheLock);
+	*hit  = hits;
+	*miss = misses;
+	pthread_mutex_unlock(&cacheLock);
+}
+
+/**
+ * Print the statistics of the cache
+ */
+void leb_cache_print_stats(void)
+{
+	unsigned long long total;
+
+	if (!leb_cache_is_enabled())
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&cacheLock);
+	total = hits + misses;
+	printf("Read cache: %llu hits, %llu misses (%.1f%% hit), %llu evictions, %llu uncached reads, %d/%d chunks of %d bytes\n",
+			hits,
+			misses,
+			total ? (100.0 * hits / total) : 0.0,
+			evictions,
+			bypasses,
+			nbEntries,
+			maxEntries,
+			chunkSize);
+	pthread_mutex_unlock(&cacheLock);
+}
+
+/**
+ * Release all the chunks
+ */
+void leb_cache_free(void)
+{
+	struct leb_cache_entry *e;
+
+	pthread_mutex_lock(&cacheLock);
+	while (lruHead != NULL)
+	{
+		e = lruHead;
+		lruHead = e->next;
+		free(e);
+	}
+	lruTail   = NULL;
+	nbEntries = 0;
+	free(hashTable);
+	hashTable = NULL;
+	chunkSize = 0;
+	pthread_mutex_unlock(&cacheLock);
+}
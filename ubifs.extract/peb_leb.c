@@ -13,6 +13,9 @@
 #include <mtd/ubi-media.h>
 #include <mtd/mtd-user.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include <libmtd.h>
 
 
@@ -33,41 +36,262 @@ enum E_LNUM_VALUE
 	LNUM_ERROR    = -2,
 	LNUM_BAD      = -3,
 	LNUM_ERASED   = -4,
+	LNUM_FASTMAP  = -5,
 };
 
-static struct
+/* Information of a PEB, also the record of the cache file (fixed layout) */
+struct peb_leb_entry
 {
+	/* Sequence number of the VID header, 0 if unknown (from fastmap) */
+	uint64_t sqnum;
+
 	/* enum E_LNUM_VALUE or the associated LEB */
-	int lnum;
+	int32_t lnum;
+
+	int32_t data_offset;
+
+	/* Volume of the LEB (valid only if lnum >= 0) */
+	int32_t vol_id;
+
+	/* The LEB was copied by the wear leveling, data CRC to check */
+	uint8_t copy_flag;
+
+	uint8_t padding[3];
+};
 
-	int data_offset;
-}
 /* Contain all the PEB */
-*pebList = NULL;
+static struct peb_leb_entry *pebList = NULL;
+
+/* Erase counter of each PEB, PEB_EC_UNKNOWN if not known (bad block...) */
+static uint32_t *ecList = NULL;
+
+#define PEB_EC_UNKNOWN (0xFFFFFFFF)
+
+/* Number of bars of the wear histogram */
+#define WEAR_HISTO_BARS (10)
+
+/* Bad block bitmap, one bit per PEB, read once */
+static uint32_t *badBlocks = NULL;
 
 /* Number of PEB for this MTD device */
 static int pebNumber = -1;
 
+/* Offset of the VID header inside a PEB, learned from the first good PEB */
+static int vidHdrOffset = -1;
+
+/* Size of one read containing EC and VID header, aligned on min_io_size, -1: 2 reads */
+static int hdrReadSize = -1;
+
+/* Offset of the LEB data inside a PEB, learned from the first good PEB */
+static int lebDataOffset = -1;
+
+/* Raw NAND image (nanddump without OOB) mapped in memory, NULL: MTD device */
+static const uint8_t *imageMap = NULL;
+
+/* Size of the imageMap mapping */
+static size_t imageMapSize = 0;
+
+/* MTD device kept open to read LEB without UBI, -1: not used */
+static int rawFd = -1;
+
+/* Image sequence number of the EC header, learned from the first good PEB */
+static uint32_t imageSeq = 0;
+
+/* Cache file of pebList, NULL: no cache */
+static const char *cacheFile = NULL;
+
+/* Mapping of the cache file holding pebList and ecList, NULL: allocated tables */
+static void  *cacheMap     = NULL;
+static size_t cacheMapSize = 0;
+
+/* Magic and version of the cache file */
+#define PEB_CACHE_MAGIC   (0x50454243)
+#define PEB_CACHE_VERSION (2)
+
+/* Number of PEB read to check the cache is still valid (+ fastmap anchor area) */
+#define PEB_CACHE_SAMPLES (64)
+
+/* Header of the cache file, followed by the pebList entries and the erase counters */
+struct peb_leb_cache_hdr
+{
+	uint32_t magic;
+	uint32_t version;
+	/* Geometry of the MTD device */
+	uint64_t size;
+	int32_t  eb_cnt;
+	int32_t  eb_size;
+	int32_t  min_io_size;
+	int32_t  vid_hdr_offset;
+	/* UBI image sequence number */
+	uint32_t image_seq;
+	uint32_t entry_size;
+	/* Highest VID sqnum of the device */
+	uint64_t max_sqnum;
+};
+
+/* Volume to index, -1: the first volume without UBI, else all user volumes */
+static int volIdToIndex = -1;
+
+/* Number of thread used to scan the PEB, 0: one per online CPU */
+static int scanThreads = 0;
+
+/* Check the CRC of the EC and VID headers during the scan */
+static int hdrCrcCheck = 0;
+
+/* Arguments of a scanning thread: range [first, last[ of PEB to scan */
+struct peb_leb_scan_arg
+{
+	pthread_t thread;
+	int       fd;
+	int       first;
+	int       last;
+};
+
+
+static struct
+{
+	/* PEB containing the LEB (the copy used by UBI), -1 if the LEB is not mapped */
+	int peb;
+
+	/* PEB containing an old copy of the LEB, -1 if none */
+	int peb2;
+}
+/* Reverse table, indexed by LEB, built from pebList */
+*lebList = NULL;
+
+/* Number of entries of lebList, a LEB number can't be greater than the PEB number */
+static int lebNumber = -1;
+
 
 /**
  * Return the PEB associated with a LEB
- * Not optimized: Better to have a sorted LEB list and use qsearch
- * So it do jobs
+ * Return -1 if the LEB is not mapped
  */
 int peb_leb_getPeb(int leb)
 {
-	int found = -1;
+	if ( (leb < 0) || (leb >= lebNumber) )
+	{
+		return -1;
+	}
+	return lebList[leb].peb;
+}
+
+/**
+ * Return the PEB containing an old copy of the LEB (not used by UBI)
+ * Return -1 if the LEB has only one copy
+ */
+int peb_leb_getPeb2(int leb)
+{
+	if ( (leb < 0) || (leb >= lebNumber) )
+	{
+		return -1;
+	}
+	return lebList[leb].peb2;
+}
+
+/**
+ * Bulk version of peb_leb_getPeb
+ * lebs: the LEB to translate
+ * pebs: receive the associated PEB (-1 if not mapped)
+ * nb: number of element of lebs and pebs
+ * Return the number of mapped LEB
+ */
+int peb_leb_getPebs(const int *lebs, int *pebs, int nb)
+{
+	int mapped = 0;
+	int i;
+
+	for (i=0; i<nb; i++)
+	{
+		pebs[i] = peb_leb_getPeb(lebs[i]);
+		if (pebs[i] >= 0)
+		{
+			mapped++;
+		}
+	}
+	return mapped;
+}
+
+/**
+ * Check if a PEB is bad, using the bad block bitmap
+ */
+static int peb_leb_is_bad(const int idx)
+{
+	return (badBlocks[idx / 32] >> (idx % 32)) & 1;
+}
+
+/**
+ * Read the bad block bitmap, once for all the passes
+ * The ECC statistics give the number of bad blocks: if there is no bad
+ * block (or if the flash can't have bad blocks), no need to check each PEB
+ * A raw image has no bad block information (bad blocks are not UBI PEB)
+ * Return 0 or -ENOMEM
+ */
+static int peb_leb_read_bad_blocks(const int fd)
+{
+	struct mtd_ecc_stats stats;
+	int nbBad = 0;
 	int i;
 
+	badBlocks = calloc((pebNumber + 31) / 32, sizeof(*badBlocks));
+	if (badBlocks == NULL)
+	{
+		printf("%s: Unable to allocate the bad block bitmap\n", __FUNCTION__);
+		return -ENOMEM;
+	}
+
+	if ( (imageMap != NULL) || (!mtd.bb_allowed) )
+	{
+		return 0;
+	}
+	if ( (ioctl(fd, ECCGETSTATS, &stats) == 0) && (stats.badblocks == 0) )
+	{
+		printf("No bad block\n");
+		return 0;
+	}
+
 	for (i=0; i<pebNumber; i++)
 	{
-		if (pebList[i].lnum == leb)
+		if (mtd_is_bad(&mtd, fd, i) > 0)
 		{
-			found = i;
-			break;
+			badBlocks[i / 32] |= 1U << (i % 32);
+			nbBad++;
 		}
 	}
-	return found;
+	printf("%d bad blocks\n", nbBad);
+	return 0;
+}
+
+/**
+ * Return 1 if the PEB is a bad block
+ */
+int peb_leb_is_bad_peb(int peb)
+{
+	if ( (peb < 0) || (peb >= pebNumber) )
+	{
+		return 0;
+	}
+	return peb_leb_is_bad(peb);
+}
+
+/**
+ * Return the erase counter of a PEB, -1 if not known
+ */
+long long peb_leb_get_ec(int peb)
+{
+	if ( (peb < 0) || (peb >= pebNumber) || (ecList[peb] == PEB_EC_UNKNOWN) )
+	{
+		return -1;
+	}
+	return ecList[peb];
+}
+
+/**
+ * Save the erase counter of a PEB (64 bits on flash, UBI limits it to 31 bits)
+ */
+static void peb_leb_set_ec(const int idx, const uint64_t ec)
+{
+	ecList[idx] = (ec > UBI_MAX_ERASECOUNTER) ? PEB_EC_UNKNOWN : (uint32_t)ec;
 }
 
 /**
@@ -96,61 +320,96 @@ int peb_leb_get_eb_size(void)
 
 
 /**
- * Read LEB information for the specified PEB index
- * So, the PEB may be bad or not mapped
- * crc of header not checked
+ * Read the EC and VID header of a PEB
+ * hdrBuf: hdrReadSize bytes to read EC and VID header at once, NULL to read them separately
+ * Return 0 if the EC header is valid (VID header magic not checked)
  */
-static int peb_leb_read_lnum(const int fd, const int idx, const int pebSize)
+static int peb_leb_read_hdrs(
+		const int fd,
+		const int idx,
+		uint8_t *hdrBuf,
+		struct ubi_ec_hdr *ech,
+		struct ubi_vid_hdr *vidh)
 {
-	off64_t           offset;
-	struct ubi_ec_hdr  ech;
-	struct ubi_vid_hdr vidh;
-	int                lnum;
+	off64_t offset;
+	int     vidOffs;
 
 	/* Compute the offset of first data of the desired PEB */
-	offset  = pebSize;
+	offset  = mtd.eb_size;
 	offset *= idx;
 
-	/* First consider ERROR */
-	pebList[idx].lnum = LNUM_ERROR;
-
-	/* Go to the first data of the PEB */
-	if ( offset != lseek64(fd, offset, SEEK_SET))
+	if (hdrBuf != NULL)
 	{
-		printf("%s:%d Error\n", __FILE__, __LINE__);
-		return -1;
+		/* Read the first pages of the PEB, containing both headers */
+		/* (positional: fd shared between threads) */
+		if (hdrReadSize != pread64(fd, hdrBuf, hdrReadSize, offset))
+		{
+			printf("%s:%d Error\n", __FILE__, __LINE__);
+			return -1;
+		}
+		memcpy(ech, hdrBuf, sizeof(*ech));
 	}
-
-	/* Read the erasable counter header */
-	if (sizeof(ech) != read(fd, &ech, sizeof(ech)))
+	/* Read the erasable counter header (positional: fd shared between threads) */
+	else if (sizeof(*ech) != pread64(fd, ech, sizeof(*ech), offset))
 	{
 		printf("%s:%d Error\n", __FILE__, __LINE__);
                 return -1;
 	}
 
 	/* Check presence of the magic */
-	if ( __builtin_bswap32(ech.magic) != UBI_EC_HDR_MAGIC)
+	if ( __builtin_bswap32(ech->magic) != UBI_EC_HDR_MAGIC)
 	{
  		printf("%s:%d Error\n", __FILE__, __LINE__);
                 return -1;
 	}
 
 	/* Forward offset to the vid header of the PEB (vid:Volume IDentifier) */
-	offset += __builtin_bswap32(ech.vid_hdr_offset);
-
-	/* Go to the VID Hdr */
-	if ( offset != lseek64(fd, offset, SEEK_SET))
-        {
-                printf("%s:%d Error\n", __FILE__, __LINE__);
-                return -1;
-        }
+	vidOffs = __builtin_bswap32(ech->vid_hdr_offset);
+	offset += vidOffs;
 
+	/* VID HDR already read with the EC HDR */
+	if ( (hdrBuf != NULL) && (vidOffs == vidHdrOffset) )
+	{
+		memcpy(vidh, hdrBuf + vidOffs, sizeof(*vidh));
+	}
 	/* Read the VID HDR */
-        if (sizeof(vidh) != read(fd, &vidh, sizeof(vidh)))
+        else if (sizeof(*vidh) != pread64(fd, vidh, sizeof(*vidh), offset))
         {
                 printf("%s:%d Error\n", __FILE__, __LINE__);
                 return -1;
         }
+	return 0;
+}
+
+/**
+ * Read LEB information for the specified PEB index
+ * So, the PEB may be bad or not mapped
+ * crc of header checked only if enabled by peb_leb_set_hdr_crc_check
+ * hdrBuf: see peb_leb_read_hdrs
+ */
+static int peb_leb_read_lnum(const int fd, const int idx, uint8_t *hdrBuf)
+{
+	struct ubi_ec_hdr  ech;
+	struct ubi_vid_hdr vidh;
+	int                lnum;
+
+	/* First consider ERROR */
+	pebList[idx].lnum = LNUM_ERROR;
+
+	if (peb_leb_read_hdrs(fd, idx, hdrBuf, &ech, &vidh))
+	{
+		return -1;
+	}
+
+	if ( hdrCrcCheck &&
+	     (crc32_fast(UBI_CRC32_INIT, &ech, UBI_EC_HDR_SIZE_CRC) != __builtin_bswap32(ech.hdr_crc)) )
+	{
+		printf("%s: PEB %d bad EC header CRC\n", __FUNCTION__, idx);
+		return -1;
+	}
+
+	/* Erase counter is valid even for an erased PEB */
+	peb_leb_set_ec(idx, __builtin_bswap64(ech.ec));
 
 	/* Check the VID HDR magic number */
         if ( __builtin_bswap32(vidh.magic) != UBI_VID_HDR_MAGIC)
@@ -171,17 +430,27 @@ static int peb_leb_read_lnum(const int fd, const int idx, const int pebSize)
 		}
         }
 
+	if ( hdrCrcCheck &&
+	     (crc32_fast(UBI_CRC32_INIT, &vidh, UBI_VID_HDR_SIZE_CRC) != __builtin_bswap32(vidh.hdr_crc)) )
+	{
+		printf("%s: PEB %d bad VID header CRC\n", __FUNCTION__, idx);
+		return -1;
+	}
+
 	/* Convert to machine endianess */
 	lnum = __builtin_bswap32(vidh.lnum);
 
 	/* Robustness check: Out of range check */
-	if ( (lnum <0) && (lnum > pebNumber) )
+	if ( (lnum < 0) || (lnum >= pebNumber) )
 	{
 		printf("%s:%d Error lnum:0x%X\n", __FILE__, __LINE__, lnum);
                 return -1;
 	}
 	/* lnum is correct, save it */
 	pebList[idx].lnum        = lnum;
+	pebList[idx].vol_id      = __builtin_bswap32(vidh.vol_id);
+	pebList[idx].sqnum       = __builtin_bswap64(vidh.sqnum);
+	pebList[idx].copy_flag   = vidh.copy_flag;
 	/* Convert to machine endianess the offset of the data's */
 	/* So point the first data of the LEB */
 	pebList[idx].data_offset = __builtin_bswap32(ech.data_offset);
@@ -190,170 +459,1639 @@ static int peb_leb_read_lnum(const int fd, const int idx, const int pebSize)
 }
 
 /**
- * Check if there is one LEB for one PEB.
- * Fast coded: Not optimised jobs, may be better to have a LEB sorted list
- * So it do the jobs and called once
- */
-static void peb_leb_check(void)
-{
-        int i, j;
-
-	printf("%s: (Note: LEB0 superblock, LEB1 master, each on 2 PEB, redundacy)\n", __FUNCTION__);
-        /* Check lnum are unique */
-        for (i=0; i<pebNumber; i++)
-        {
-		/* May be PEB is a bad block */
-		if (pebList[i].lnum == LNUM_BAD)
-		{
-			printf("PEB %d is BAD BLK\n", i);
-		}
-
-		/* Second loop: on last iteration of the first loop, due to j+1, loop not executed */
-                for (j=i+1; j<pebNumber; j++)
-                {
-                        if (
-					(pebList[i].lnum == pebList[j].lnum) &&
-					(pebList[i].lnum >= 0) &&
-					(pebList[j].lnum >= 0) )
-
-                        {
-                                 printf("%s:%d Error Multiple LEB %d PEB1 %d PEB2 %d\n",
-						 __FILE__,
-						 __LINE__,
-                                                 pebList[j].lnum,
-                                                 i,
-                                                 j);
-                        }
-                }
-        }
-}
-
-
-#ifdef PEB_LEB_SHOW
-
-/**
- * Show the PEB table
+ * Read LEB information of the PEB range [first, last[
  */
-static void peb_leb_show(void)
+static void peb_leb_scan_range(const int fd, const int first, const int last)
 {
+	uint8_t *hdrBuf = NULL;
 	int i;
 
-
-	printf("Link PEB => LEB:");
-	for (i=0; i<pebNumber; i++)
+	/* Buffer for the single read of the headers */
+	if (hdrReadSize > 0)
 	{
-		if (  (i % 5) ==0)
-                {
-                        printf("\n");
-                }
+		hdrBuf = malloc(hdrReadSize);
+	}
 
-		switch (pebList[i].lnum)
+	for (i=first; i<last; i++)
+	{
+		/* Before accessing to the PEB, check if it's BAD */
+		if (peb_leb_is_bad(i))
 		{
-			case LNUM_NOT_INIT:
-				printf("%4d:INIT|", i);
-				break;
-			case LNUM_ERROR:
-				printf("%4d:ERRO|", i);
-				break;
-			case LNUM_BAD:
-				printf("%4d:BAD |", i);
- 				break;
-			case LNUM_ERASED:
-				printf("%4d:UMAP|", i);
-                                break;
-			default:
-				printf("%4d:%4d|", i, pebList[i].lnum);
-				break;
-		}		
+//			printf("PEB #%d is Bad\n", i);
+			pebList[i].lnum = LNUM_BAD;
+		}
+		else if(peb_leb_read_lnum(fd, i, hdrBuf))
+		{
+			printf("Error PEB %d\n", i);
+		}
 	}
-	printf("\n");
+	free(hdrBuf);
 }
-#endif
 
 /**
- * Initialize the PEB/LEB information
- * use ioctl MEMGETINFO
+ * Learn the VID header offset from the first good PEB
+ * On NAND a small read cost a full page read, so EC and VID header
+ * are read at once with a read aligned on min_io_size
  */
-int peb_leb_init(const char *mtd_device)
+static void peb_leb_learn_hdr_layout(const int fd)
 {
-	libmtd_t mtd_desc;
-	int fd;
+	struct ubi_ec_hdr ech;
+	off64_t offset;
+	int ioSize;
 	int i;
 
+	ioSize = (mtd.min_io_size > 0) ? mtd.min_io_size : 1;
 
-	if (pebList == NULL)
+	for (i=0; i<pebNumber; i++)
 	{
-		/* Initialize libmtd */
-		mtd_desc = libmtd_open();
-		if (!mtd_desc)
+		if (peb_leb_is_bad(i))
 		{
-			printf("can't initialize libmtd\n");
-			return __LINE__;
+			continue;
 		}
 
-		/* Open the device in read only mode */
-		printf("Opening %s in RDONLY\n", mtd_device);
- 		fd = open(mtd_device, O_RDONLY);
-                if (fd < 0)
-                {
-                        printf("%s: Unable to open %s\n", __FUNCTION__, mtd_device);
-                        return __LINE__;
-                }
-
-		/* Fill in MTD device capability structure */
-		if (mtd_get_dev_info(mtd_desc, mtd_device, &mtd) < 0)
+		offset  = mtd.eb_size;
+		offset *= i;
+		if (sizeof(ech) != pread64(fd, &ech, sizeof(ech), offset))
 		{
-			printf("%s: Error mtd_get_dev_info\n", __FUNCTION__);
-                        return __LINE__;
+			continue;
 		}
 
-		/* Save the erasable counter */
-		pebNumber = mtd.eb_cnt;
-
-		printf("Total Size:%lld\n", mtd.size);
-		printf("Erase Size:%d\n",   mtd.eb_size);
-		printf("Write Size:%d\n",   mtd.min_io_size);
-		printf("Number of PEB:%d\n", pebNumber);
-
-
-		/* Allocate area with zero */
-		pebList = calloc(pebNumber, sizeof(*pebList));
-
-		/* Initialise all PEB with an invalid LEB information */
-		for (i=0; i<pebNumber; i++)
+		/* Erased or corrupted PEB, try the next one */
+		if ( __builtin_bswap32(ech.magic) != UBI_EC_HDR_MAGIC)
 		{
-			pebList[i].lnum = LNUM_NOT_INIT;
+			continue;
 		}
 
-		printf("Reading PEB LEB link\n");
-		for (i=0; i<pebNumber; i++)
+		imageSeq      = __builtin_bswap32(ech.image_seq);
+		lebDataOffset = __builtin_bswap32(ech.data_offset);
+		vidHdrOffset  = __builtin_bswap32(ech.vid_hdr_offset);
+		if ( (vidHdrOffset < (int)sizeof(ech)) ||
+		     (vidHdrOffset + (int)sizeof(struct ubi_vid_hdr) > mtd.eb_size) )
 		{
-			/* Before accessing to the PEB, check if it's BAD */
-			if (mtd_is_bad(&mtd, fd, i))
-			{
-//				printf("PEB #%d is Bad\n", i);
-				pebList[i].lnum = LNUM_BAD;
-			}
-			else if(peb_leb_read_lnum(fd, i, mtd.eb_size))
-			{
-				printf("Error PEB %d\n", i);
-			}
+			printf("%s: Bad VID header offset %d in PEB %d\n", __FUNCTION__, vidHdrOffset, i);
+			vidHdrOffset = -1;
+			return;
 		}
 
-		peb_leb_check();
-#ifdef PEB_LEB_SHOW
-		peb_leb_show();
-#endif
-
-		close(fd);
+		/* Round up to the next min_io_size boundary */
+		hdrReadSize  = vidHdrOffset + sizeof(struct ubi_vid_hdr) + ioSize - 1;
+		hdrReadSize -= hdrReadSize % ioSize;
 
-		printf("end\n");
+		printf("VID Header offset:%d (read %d bytes per PEB)\n", vidHdrOffset, hdrReadSize);
+		return;
 	}
-	else
-	{
-		printf("%s: already initialized\n", __FUNCTION__);
-	}
-	return 0;
 }
 
+/**
+ * Scanning thread entry point
+ */
+static void *peb_leb_scan_thread(void *arg)
+{
+	struct peb_leb_scan_arg *scan = arg;
 
+	peb_leb_scan_range(scan->fd, scan->first, scan->last);
+
+	return NULL;
+}
+
+/**
+ * Read LEB information of all the PEB
+ * Each thread fills a disjoint range of pebList, so no lock is needed
+ * Fall back to the calling thread if a thread can't be created
+ */
+static void peb_leb_scan(const int fd)
+{
+	struct peb_leb_scan_arg *scan;
+	int nbThread;
+	int i;
+
+	nbThread = scanThreads;
+	if (nbThread <= 0)
+	{
+		nbThread = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (nbThread > pebNumber)
+	{
+		nbThread = pebNumber;
+	}
+	if (nbThread <= 1)
+	{
+		peb_leb_scan_range(fd, 0, pebNumber);
+		return;
+	}
+
+	printf("Scanning with %d threads\n", nbThread);
+
+	scan = calloc(nbThread, sizeof(*scan));
+	if (scan == NULL)
+	{
+		peb_leb_scan_range(fd, 0, pebNumber);
+		return;
+	}
+
+	for (i=0; i<nbThread; i++)
+	{
+		scan[i].fd    = fd;
+		scan[i].first = (int)(((int64_t)pebNumber * i)       / nbThread);
+		scan[i].last  = (int)(((int64_t)pebNumber * (i + 1)) / nbThread);
+
+		if (pthread_create(&scan[i].thread, NULL, peb_leb_scan_thread, &scan[i]))
+		{
+			/* Do the job in the current thread */
+			printf("%s: Unable to create thread %d\n", __FUNCTION__, i);
+			peb_leb_scan_range(fd, scan[i].first, scan[i].last);
+			scan[i].fd = -1;
+		}
+	}
+
+	for (i=0; i<nbThread; i++)
+	{
+		if (scan[i].fd >= 0)
+		{
+			pthread_join(scan[i].thread, NULL);
+		}
+	}
+	free(scan);
+}
+
+/**
+ * Set the number of thread used to scan the PEB
+ * 0: one thread per online CPU, 1: no thread
+ */
+void peb_leb_set_threads(int nbThread)
+{
+	scanThreads = nbThread;
+}
+
+/**
+ * Check the CRC of the EC and VID headers during the scan
+ * A PEB with a bad header CRC is considered in error
+ */
+void peb_leb_set_hdr_crc_check(int enable)
+{
+	hdrCrcCheck = enable;
+}
+
+/**
+ * Find the fastmap anchor: the PEB of the fastmap super block volume,
+ * in the first UBI_FM_MAX_START PEB, with the highest sequence number
+ * dataOffset: receive the data offset of the anchor PEB
+ * Return the anchor PEB or -1 if there is no fastmap
+ */
+static int peb_leb_fastmap_anchor(const int fd, uint8_t *hdrBuf, int *dataOffset)
+{
+	struct ubi_ec_hdr  ech;
+	struct ubi_vid_hdr vidh;
+	uint64_t sqnum;
+	uint64_t maxSqnum = 0;
+	int anchor = -1;
+	int nb;
+	int i;
+
+	nb = (pebNumber < UBI_FM_MAX_START) ? pebNumber : UBI_FM_MAX_START;
+	for (i=0; i<nb; i++)
+	{
+		if (peb_leb_is_bad(i))
+		{
+			continue;
+		}
+		if (peb_leb_read_hdrs(fd, i, hdrBuf, &ech, &vidh))
+		{
+			continue;
+		}
+		if ( (__builtin_bswap32(vidh.magic)  != UBI_VID_HDR_MAGIC) ||
+		     (__builtin_bswap32(vidh.vol_id) != UBI_FM_SB_VOLUME_ID) )
+		{
+			continue;
+		}
+
+		/* Keep the most recent anchor */
+		sqnum = __builtin_bswap64(vidh.sqnum);
+		if ( (anchor < 0) || (sqnum > maxSqnum) )
+		{
+			anchor        = i;
+			maxSqnum      = sqnum;
+			(*dataOffset) = __builtin_bswap32(ech.data_offset);
+		}
+	}
+	return anchor;
+}
+
+/**
+ * Read a PEB of a fastmap pool
+ * Pool PEB were given to UBI after the fastmap was written, so they may
+ * contain a newer copy of a LEB listed in the EBA table: all the copies
+ * stay mapped, peb_leb_build_index selects the one used by UBI
+ */
+static void peb_leb_fastmap_pool_peb(const int fd, const int pnum, uint8_t *hdrBuf)
+{
+	if (peb_leb_is_bad(pnum))
+	{
+		pebList[pnum].lnum = LNUM_BAD;
+		return;
+	}
+	if (peb_leb_read_lnum(fd, pnum, hdrBuf))
+	{
+		printf("Error PEB %d\n", pnum);
+	}
+}
+
+/* Helper for peb_leb_fastmap: point the next fastmap structure, go to error if out of fastmap */
+#define FM_NEXT(ptr, size)					\
+	do {							\
+		if (pos + (int)(size) > fmSize)			\
+		{						\
+			printf("%s: Fastmap too short\n", __FUNCTION__); \
+			goto out;				\
+		}						\
+		ptr  = (void *)(fmRaw + pos);			\
+		pos += (size);					\
+	} while (0)
+
+/**
+ * Fill the PEB table using the UBI fastmap, if any
+ * The fastmap contains the EBA table of each volume, so only the fastmap,
+ * the pool PEB and the PEB unknown by the fastmap are read
+ * Return 0 if the PEB table is filled, else a full scan is needed
+ */
+static int peb_leb_fastmap(const int fd)
+{
+	struct ubi_ec_hdr        ech;
+	struct ubi_vid_hdr       vidh;
+	struct ubi_fm_sb         fmsb;
+	struct ubi_fm_sb        *fmsb2;
+	struct ubi_fm_hdr       *fmhdr;
+	struct ubi_fm_scan_pool *fmpl[2];
+	struct ubi_fm_ec        *fmec;
+	struct ubi_fm_volhdr    *fmvhdr;
+	struct ubi_fm_eba       *fmeba;
+	uint8_t *hdrBuf = NULL;
+	uint8_t *fmRaw  = NULL;
+	uint32_t listSize[4];
+	uint32_t dataCrc;
+	uint64_t fmSqnum[UBI_FM_MAX_BLOCKS];
+	off64_t  offset;
+	int anchor;
+	int dataOffset = 0;
+	int lebSize;
+	int usedBlocks;
+	int fmSize = 0;
+	int pos;
+	int pnum;
+	int volId;
+	int volCount;
+	int reserved;
+	int nbScanned = 0;
+	int ret = -1;
+	int i, j, k;
+
+	if (hdrReadSize > 0)
+	{
+		hdrBuf = malloc(hdrReadSize);
+	}
+
+	anchor = peb_leb_fastmap_anchor(fd, hdrBuf, &dataOffset);
+	if (anchor < 0)
+	{
+		printf("No fastmap found\n");
+		goto out;
+	}
+
+	/* Read the fastmap super block */
+	offset  = mtd.eb_size;
+	offset *= anchor;
+	offset += dataOffset;
+	if (sizeof(fmsb) != pread64(fd, &fmsb, sizeof(fmsb), offset))
+	{
+		printf("%s:%d Error\n", __FILE__, __LINE__);
+		goto out;
+	}
+	usedBlocks = __builtin_bswap32(fmsb.used_blocks);
+	if ( (__builtin_bswap32(fmsb.magic) != UBI_FM_SB_MAGIC) ||
+	     (fmsb.version != UBI_FM_FMT_VERSION) ||
+	     (usedBlocks < 1) || (usedBlocks > UBI_FM_MAX_BLOCKS) )
+	{
+		printf("%s: Bad fastmap super block in PEB %d\n", __FUNCTION__, anchor);
+		goto out;
+	}
+	printf("Fastmap anchor in PEB %d, %d PEB used\n", anchor, usedBlocks);
+
+	/* Read all the fastmap PEB */
+	lebSize = mtd.eb_size - dataOffset;
+	fmSize  = lebSize * usedBlocks;
+	fmRaw   = malloc(fmSize);
+	if (fmRaw == NULL)
+	{
+		printf("%s: Unable to allocate %d bytes\n", __FUNCTION__, fmSize);
+		goto out;
+	}
+	for (i=0; i<usedBlocks; i++)
+	{
+		pnum = __builtin_bswap32(fmsb.block_loc[i]);
+		if ( (pnum < 0) || (pnum >= pebNumber) || ( (i == 0) && (pnum != anchor) ) )
+		{
+			printf("%s: Bad fastmap PEB %d\n", __FUNCTION__, pnum);
+			goto out;
+		}
+		if (peb_leb_read_hdrs(fd, pnum, hdrBuf, &ech, &vidh))
+		{
+			goto out;
+		}
+		if ( (__builtin_bswap32(vidh.magic)  != UBI_VID_HDR_MAGIC) ||
+		     (__builtin_bswap32(vidh.vol_id) != ((i == 0) ? UBI_FM_SB_VOLUME_ID : UBI_FM_DATA_VOLUME_ID)) )
+		{
+			printf("%s: PEB %d is not a fastmap PEB\n", __FUNCTION__, pnum);
+			goto out;
+		}
+		fmSqnum[i] = __builtin_bswap64(vidh.sqnum);
+
+		offset  = mtd.eb_size;
+		offset *= pnum;
+		offset += __builtin_bswap32(ech.data_offset);
+		if (lebSize != pread64(fd, fmRaw + i*lebSize, lebSize, offset))
+		{
+			printf("%s:%d Error\n", __FILE__, __LINE__);
+			goto out;
+		}
+	}
+
+	/* CRC is computed with a zero CRC field */
+	fmsb2 = (struct ubi_fm_sb *)fmRaw;
+	dataCrc = __builtin_bswap32(fmsb2->data_crc);
+	fmsb2->data_crc = 0;
+	if (dataCrc != crc32_fast(UBI_CRC32_INIT, fmRaw, fmSize))
+	{
+		printf("%s: Bad fastmap CRC\n", __FUNCTION__);
+		goto out;
+	}
+
+	pos = sizeof(struct ubi_fm_sb);
+	FM_NEXT(fmhdr, sizeof(*fmhdr));
+	if (__builtin_bswap32(fmhdr->magic) != UBI_FM_HDR_MAGIC)
+	{
+		printf("%s: Bad fastmap header magic\n", __FUNCTION__);
+		goto out;
+	}
+
+	/* Pool, and pool of the wear leveling */
+	for (k=0; k<2; k++)
+	{
+		FM_NEXT(fmpl[k], sizeof(*fmpl[k]));
+		if ( (__builtin_bswap32(fmpl[k]->magic) != UBI_FM_POOL_MAGIC) ||
+		     (__builtin_bswap16(fmpl[k]->size)  >  UBI_FM_MAX_POOL_SIZE) )
+		{
+			printf("%s: Bad fastmap pool\n", __FUNCTION__);
+			goto out;
+		}
+	}
+
+	/* Free, used, scrub and erase list */
+	listSize[0] = __builtin_bswap32(fmhdr->free_peb_count);
+	listSize[1] = __builtin_bswap32(fmhdr->used_peb_count);
+	listSize[2] = __builtin_bswap32(fmhdr->scrub_peb_count);
+	listSize[3] = __builtin_bswap32(fmhdr->erase_peb_count);
+	for (k=0; k<4; k++)
+	{
+		for (j=0; j<listSize[k]; j++)
+		{
+			FM_NEXT(fmec, sizeof(*fmec));
+			pnum = __builtin_bswap32(fmec->pnum);
+			if ( (pnum < 0) || (pnum >= pebNumber) )
+			{
+				printf("%s: Bad PEB %d in fastmap list\n", __FUNCTION__, pnum);
+				goto out;
+			}
+			peb_leb_set_ec(pnum, __builtin_bswap32(fmec->ec));
+			/* Free or to be erased: no LEB, used PEB are found in the EBA table */
+			if ( (k == 0) || (k == 3) )
+			{
+				pebList[pnum].lnum = LNUM_ERASED;
+			}
+		}
+	}
+
+	/* EBA table of each volume */
+	volCount = __builtin_bswap32(fmhdr->vol_count);
+	for (i=0; i<volCount; i++)
+	{
+		FM_NEXT(fmvhdr, sizeof(*fmvhdr));
+		FM_NEXT(fmeba,  sizeof(*fmeba));
+		if ( (__builtin_bswap32(fmvhdr->magic) != UBI_FM_VHDR_MAGIC) ||
+		     (__builtin_bswap32(fmeba->magic)  != UBI_FM_EBA_MAGIC) )
+		{
+			printf("%s: Bad fastmap volume %d\n", __FUNCTION__, i);
+			goto out;
+		}
+		volId    = __builtin_bswap32(fmvhdr->vol_id);
+		reserved = __builtin_bswap32(fmeba->reserved_pebs);
+		if ( (reserved < 0) || (reserved > pebNumber) || (pos + reserved*(int)sizeof(__be32) > fmSize) )
+		{
+			printf("%s: Bad EBA table for volume %d\n", __FUNCTION__, volId);
+			goto out;
+		}
+		pos += reserved * sizeof(__be32);
+
+		for (j=0; j<reserved; j++)
+		{
+			pnum = (int)__builtin_bswap32(fmeba->pnum[j]);
+			/* LEB not mapped */
+			if (pnum < 0)
+			{
+				continue;
+			}
+			if (pnum >= pebNumber)
+			{
+				printf("%s: Bad PEB %d for LEB %d\n", __FUNCTION__, pnum, j);
+				goto out;
+			}
+			pebList[pnum].lnum        = j;
+			pebList[pnum].vol_id      = volId;
+			pebList[pnum].data_offset = dataOffset;
+			pebList[pnum].sqnum       = 0;
+			pebList[pnum].copy_flag   = 0;
+		}
+	}
+
+	/* The fastmap PEB, with their sqnum: the newest of the EBA table */
+	for (i=0; i<usedBlocks; i++)
+	{
+		pnum = __builtin_bswap32(fmsb.block_loc[i]);
+		pebList[pnum].lnum  = LNUM_FASTMAP;
+		pebList[pnum].sqnum = fmSqnum[i];
+		peb_leb_set_ec(pnum, __builtin_bswap32(fmsb.block_ec[i]));
+	}
+
+	/* PEB of the pools may have been written after the fastmap */
+	for (k=0; k<2; k++)
+	{
+		for (j=0; j<__builtin_bswap16(fmpl[k]->size); j++)
+		{
+			pnum = __builtin_bswap32(fmpl[k]->pebs[j]);
+			if ( (pnum >= 0) && (pnum < pebNumber) )
+			{
+				peb_leb_fastmap_pool_peb(fd, pnum, hdrBuf);
+				nbScanned++;
+			}
+		}
+	}
+
+	/* PEB unknown by the fastmap: bad blocks, or read it */
+	for (i=0; i<pebNumber; i++)
+	{
+		if (pebList[i].lnum != LNUM_NOT_INIT)
+		{
+			continue;
+		}
+		if (peb_leb_is_bad(i))
+		{
+			pebList[i].lnum = LNUM_BAD;
+		}
+		else
+		{
+			if (peb_leb_read_lnum(fd, i, hdrBuf))
+			{
+				printf("Error PEB %d\n", i);
+			}
+			nbScanned++;
+		}
+	}
+
+	printf("Fastmap: %d volumes, %d PEB scanned\n", volCount, nbScanned);
+	ret = 0;
+
+out:
+	free(fmRaw);
+	free(hdrBuf);
+	return ret;
+}
+
+/**
+ * Print the bad blocks
+ */
+static void peb_leb_check(void)
+{
+        int i;
+
+        for (i=0; i<pebNumber; i++)
+        {
+		/* May be PEB is a bad block */
+		if (pebList[i].lnum == LNUM_BAD)
+		{
+			printf("PEB %d is BAD BLK\n", i);
+		}
+        }
+}
+
+/**
+ * Check the data CRC of a PEB with the copy flag set
+ * When the wear leveling copies a LEB and is interrupted, the new copy may
+ * be incomplete: the data CRC of the VID header tells if it's valid
+ * Return 1 if the data's are valid
+ */
+static int peb_leb_copy_valid(const int fd, const int pnum)
+{
+	struct ubi_ec_hdr  ech;
+	struct ubi_vid_hdr vidh;
+	uint8_t *data;
+	off64_t  offset;
+	int      dataSize;
+	int      valid = 0;
+
+	if (peb_leb_read_hdrs(fd, pnum, NULL, &ech, &vidh))
+	{
+		return 0;
+	}
+
+	dataSize = __builtin_bswap32(vidh.data_size);
+	if ( (dataSize < 0) || (dataSize > mtd.eb_size - pebList[pnum].data_offset) )
+	{
+		return 0;
+	}
+
+	data = malloc(dataSize + 1);
+	if (data == NULL)
+	{
+		return 0;
+	}
+
+	offset  = mtd.eb_size;
+	offset *= pnum;
+	offset += pebList[pnum].data_offset;
+	if ( (dataSize == pread64(fd, data, dataSize, offset)) &&
+	     (crc32_fast(UBI_CRC32_INIT, data, dataSize) == __builtin_bswap32(vidh.data_crc)) )
+	{
+		valid = 1;
+	}
+	free(data);
+
+	return valid;
+}
+
+/**
+ * Read the sqnum of a PEB filled from the fastmap EBA table (sqnum 0:
+ * unknown), to compare it with another copy of its LEB
+ */
+static void peb_leb_read_sqnum(const int fd, const int pnum)
+{
+	struct ubi_ec_hdr  ech;
+	struct ubi_vid_hdr vidh;
+
+	if (pebList[pnum].sqnum != 0)
+	{
+		return;
+	}
+	if ( (peb_leb_read_hdrs(fd, pnum, NULL, &ech, &vidh) == 0) &&
+	     (__builtin_bswap32(vidh.magic) == UBI_VID_HDR_MAGIC) )
+	{
+		pebList[pnum].sqnum     = __builtin_bswap64(vidh.sqnum);
+		pebList[pnum].copy_flag = vidh.copy_flag;
+	}
+	else
+	{
+		printf("%s: Unable to read the sqnum of PEB %d\n", __FUNCTION__, pnum);
+	}
+}
+
+/**
+ * Select the copy of a LEB used by UBI (same rule as the UBI attach)
+ * The newest copy (highest sqnum) is used, except if it's a wear leveling
+ * copy with bad data CRC
+ * Return the PEB used by UBI
+ */
+static int peb_leb_newest(const int fd, const int peb1, const int peb2)
+{
+	int newer, older;
+
+	/* Copy from the fastmap: its sqnum is read now */
+	peb_leb_read_sqnum(fd, peb1);
+	peb_leb_read_sqnum(fd, peb2);
+
+	if (pebList[peb1].sqnum == pebList[peb2].sqnum)
+	{
+		printf("%s: PEB %d and %d have the same sqnum %llu, keep PEB %d\n",
+				__FUNCTION__,
+				peb1,
+				peb2,
+				(unsigned long long)pebList[peb1].sqnum,
+				peb1);
+		return peb1;
+	}
+
+	if (pebList[peb1].sqnum > pebList[peb2].sqnum)
+	{
+		newer = peb1;
+		older = peb2;
+	}
+	else
+	{
+		newer = peb2;
+		older = peb1;
+	}
+
+	if ( (pebList[newer].copy_flag) && (!peb_leb_copy_valid(fd, newer)) )
+	{
+		printf("%s: PEB %d is a bad copy, use PEB %d\n", __FUNCTION__, newer, older);
+		return older;
+	}
+	return newer;
+}
+
+/**
+ * Build the LEB indexed table from the PEB table
+ * Only the user volume volId is used (-1: all, internal volumes have their own LEB's)
+ * In case of multiple copies of a LEB, the UBI rule select the copy
+ * kept in peb, the newest other one is kept in peb2
+ */
+static int peb_leb_build_index(const int fd, const int volId)
+{
+	int lnum;
+	int live;
+	int other;
+	int dropped;
+	int i;
+
+	lebNumber = pebNumber;
+	lebList   = malloc(lebNumber * sizeof(*lebList));
+	if (lebList == NULL)
+	{
+		printf("%s: Unable to allocate LEB table\n", __FUNCTION__);
+		lebNumber = -1;
+		return -1;
+	}
+
+	/* No LEB mapped */
+	for (i=0; i<lebNumber; i++)
+	{
+		lebList[i].peb  = -1;
+		lebList[i].peb2 = -1;
+	}
+
+	for (i=0; i<pebNumber; i++)
+	{
+		lnum = pebList[i].lnum;
+
+		/* BAD, ERASED...: no LEB in this PEB */
+		if (lnum < 0)
+		{
+			continue;
+		}
+
+		/* Internal volume (layout volume), or not the volume to index */
+		if ( (pebList[i].vol_id >= UBI_INTERNAL_VOL_START) ||
+		     ( (volId >= 0) && (pebList[i].vol_id != volId) ) )
+		{
+			continue;
+		}
+
+		if (lebList[lnum].peb < 0)
+		{
+			lebList[lnum].peb = i;
+			continue;
+		}
+
+		/* Keep the copy used by UBI in peb, the newest other copy in peb2 */
+		live = peb_leb_newest(fd, lebList[lnum].peb, i);
+		if (live == i)
+		{
+			other = lebList[lnum].peb;
+			lebList[lnum].peb = i;
+		}
+		else
+		{
+			other = i;
+		}
+
+		if (lebList[lnum].peb2 >= 0)
+		{
+			/* sqnum already read by peb_leb_newest */
+			dropped = (pebList[other].sqnum > pebList[lebList[lnum].peb2].sqnum) ?
+					lebList[lnum].peb2 : other;
+			printf("%s: LEB %d found in more than 2 PEB (%d %d %d), PEB %d ignored\n",
+					__FUNCTION__,
+					lnum,
+					lebList[lnum].peb,
+					lebList[lnum].peb2,
+					other,
+					dropped);
+			if (dropped == lebList[lnum].peb2)
+			{
+				lebList[lnum].peb2 = other;
+			}
+		}
+		else
+		{
+			lebList[lnum].peb2 = other;
+		}
+
+		printf("Multiple LEB %d in PEB %d and PEB %d, PEB %d used\n",
+				lnum,
+				lebList[lnum].peb,
+				lebList[lnum].peb2,
+				live);
+	}
+	return 0;
+}
+
+/**
+ * Set the volume to index, call before peb_leb_init
+ * -1: the first volume of the volume table when the LEB are read without
+ * UBI, else all user volumes (only one user volume on the MTD device)
+ */
+void peb_leb_set_vol_id(int volId)
+{
+	volIdToIndex = volId;
+}
+
+
+#ifdef PEB_LEB_SHOW
+
+/**
+ * Show the PEB table
+ */
+static void peb_leb_show(void)
+{
+	int i;
+
+
+	printf("Link PEB => LEB:");
+	for (i=0; i<pebNumber; i++)
+	{
+		if (  (i % 5) ==0)
+                {
+                        printf("\n");
+                }
+
+		switch (pebList[i].lnum)
+		{
+			case LNUM_NOT_INIT:
+				printf("%4d:INIT|", i);
+				break;
+			case LNUM_ERROR:
+				printf("%4d:ERRO|", i);
+				break;
+			case LNUM_BAD:
+				printf("%4d:BAD |", i);
+ 				break;
+			case LNUM_ERASED:
+				printf("%4d:UMAP|", i);
+                                break;
+			case LNUM_FASTMAP:
+				printf("%4d:FM  |", i);
+				break;
+			default:
+				printf("%4d:%4d|", i, pebList[i].lnum);
+				break;
+		}		
+	}
+	printf("\n");
+}
+#endif
+
+/**
+ * Set the cache file of the PEB table, call before peb_leb_init
+ * The file is used if the MTD device has not changed, else it's rewritten
+ */
+void peb_leb_set_cache_file(const char *fileName)
+{
+	cacheFile = fileName;
+}
+
+/**
+ * Check a PEB of the device is still described by a cache entry
+ * maxSqnum: any VID header newer than this one means the device was written
+ * Return 1 if the entry is valid
+ */
+static int peb_leb_cache_entry_valid(
+		const int fd,
+		const int idx,
+		uint8_t *hdrBuf,
+		const struct peb_leb_entry *entry,
+		const uint64_t maxSqnum)
+{
+	struct ubi_ec_hdr  ech;
+	struct ubi_vid_hdr vidh;
+
+	if (peb_leb_is_bad(idx))
+	{
+		return entry->lnum == LNUM_BAD;
+	}
+	if (peb_leb_read_hdrs(fd, idx, hdrBuf, &ech, &vidh))
+	{
+		return entry->lnum == LNUM_ERROR;
+	}
+	if (__builtin_bswap32(ech.image_seq) != imageSeq)
+	{
+		return 0;
+	}
+	if (__builtin_bswap32(vidh.magic) != UBI_VID_HDR_MAGIC)
+	{
+		return (vidh.magic == 0xFFFFFFFF) && (entry->lnum == LNUM_ERASED);
+	}
+
+	/* Written after the cache */
+	if (__builtin_bswap64(vidh.sqnum) > maxSqnum)
+	{
+		return 0;
+	}
+
+	switch (entry->lnum)
+	{
+		case LNUM_ERASED:
+			/* Old copy, waiting to be erased */
+			return 1;
+		case LNUM_FASTMAP:
+			return __builtin_bswap32(vidh.vol_id) >= UBI_INTERNAL_VOL_START;
+		default:
+			return (entry->lnum   == (int32_t)__builtin_bswap32(vidh.lnum))   &&
+			       (entry->vol_id == (int32_t)__builtin_bswap32(vidh.vol_id)) &&
+			       ( (entry->sqnum == 0) || (entry->sqnum == __builtin_bswap64(vidh.sqnum)) );
+	}
+}
+
+/**
+ * Load the PEB table from the cache file
+ * The file is mapped (private mapping: pebList may be modified)
+ * The geometry and the image sequence number must be the same, and a
+ * sample of PEB (evenly spread + fastmap anchor area) is read again
+ * Return 0 if pebList points to the cache
+ */
+static int peb_leb_cache_load(const int fd)
+{
+	struct peb_leb_cache_hdr *hdr;
+	struct peb_leb_entry     *entries;
+	struct stat st;
+	uint8_t *hdrBuf = NULL;
+	void    *map;
+	int      cacheFd;
+	int      stride;
+	int      valid = 1;
+	int      nbChecked = 0;
+	int      i;
+
+	if (cacheFile == NULL)
+	{
+		return -1;
+	}
+
+	cacheFd = open(cacheFile, O_RDONLY);
+	if (cacheFd < 0)
+	{
+		printf("No PEB cache %s\n", cacheFile);
+		return -1;
+	}
+	if ( (fstat(cacheFd, &st) != 0) ||
+	     (st.st_size != sizeof(*hdr) + (off_t)pebNumber * (sizeof(*entries) + sizeof(*ecList))) )
+	{
+		printf("%s: Bad size of %s\n", __FUNCTION__, cacheFile);
+		close(cacheFd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, cacheFd, 0);
+	close(cacheFd);
+	if (map == MAP_FAILED)
+	{
+		printf("%s: Unable to map %s\n", __FUNCTION__, cacheFile);
+		return -1;
+	}
+	hdr     = map;
+	entries = (struct peb_leb_entry *)(hdr + 1);
+
+	if ( (hdr->magic          != PEB_CACHE_MAGIC)   ||
+	     (hdr->version        != PEB_CACHE_VERSION) ||
+	     (hdr->size           != mtd.size)          ||
+	     (hdr->eb_cnt         != mtd.eb_cnt)        ||
+	     (hdr->eb_size        != mtd.eb_size)       ||
+	     (hdr->min_io_size    != mtd.min_io_size)   ||
+	     (hdr->vid_hdr_offset != vidHdrOffset)      ||
+	     (hdr->image_seq      != imageSeq)          ||
+	     (hdr->entry_size     != sizeof(*entries)) )
+	{
+		printf("PEB cache %s is for another device\n", cacheFile);
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	if (hdrReadSize > 0)
+	{
+		hdrBuf = malloc(hdrReadSize);
+	}
+
+	stride = pebNumber / PEB_CACHE_SAMPLES;
+	if (stride < 1)
+	{
+		stride = 1;
+	}
+	for (i=0; (i<pebNumber) && valid; i++)
+	{
+		if ( (i >= UBI_FM_MAX_START) && (i % stride) )
+		{
+			continue;
+		}
+		valid = peb_leb_cache_entry_valid(fd, i, hdrBuf, &entries[i], hdr->max_sqnum);
+		if (!valid)
+		{
+			printf("PEB cache: PEB %d changed\n", i);
+		}
+		nbChecked++;
+	}
+	free(hdrBuf);
+
+	if (!valid)
+	{
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	printf("PEB cache %s used (%d PEB checked)\n", cacheFile, nbChecked);
+	free(pebList);
+	free(ecList);
+	pebList      = entries;
+	ecList       = (uint32_t *)(entries + pebNumber);
+	cacheMap     = map;
+	cacheMapSize = st.st_size;
+
+	return 0;
+}
+
+/**
+ * Save the PEB table in the cache file
+ * Written in a temporary file then renamed: a cache is always complete
+ */
+static void peb_leb_cache_save(void)
+{
+	struct peb_leb_cache_hdr hdr;
+	char   tmpName[400];
+	FILE  *fd;
+	int    i;
+
+	if (cacheFile == NULL)
+	{
+		return;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic          = PEB_CACHE_MAGIC;
+	hdr.version        = PEB_CACHE_VERSION;
+	hdr.size           = mtd.size;
+	hdr.eb_cnt         = mtd.eb_cnt;
+	hdr.eb_size        = mtd.eb_size;
+	hdr.min_io_size    = mtd.min_io_size;
+	hdr.vid_hdr_offset = vidHdrOffset;
+	hdr.image_seq      = imageSeq;
+	hdr.entry_size     = sizeof(*pebList);
+	/* With a fastmap, the sqnum of the fastmap PEB (anchor included) are
+	 * newer than the EBA entries of the fastmap (sqnum 0) */
+	for (i=0; i<pebNumber; i++)
+	{
+		if (pebList[i].sqnum > hdr.max_sqnum)
+		{
+			hdr.max_sqnum = pebList[i].sqnum;
+		}
+	}
+
+	snprintf(tmpName, sizeof(tmpName), "%s.tmp", cacheFile);
+	fd = fopen(tmpName, "w");
+	if (fd == NULL)
+	{
+		printf("%s: Unable to open %s\n", __FUNCTION__, tmpName);
+		return;
+	}
+	if ( (1         != fwrite(&hdr,    sizeof(hdr),      1,         fd)) ||
+	     (pebNumber != fwrite(pebList, sizeof(*pebList), pebNumber, fd)) ||
+	     (pebNumber != fwrite(ecList,  sizeof(*ecList),  pebNumber, fd)) )
+	{
+		printf("%s: Unable to write %s\n", __FUNCTION__, tmpName);
+		fclose(fd);
+		unlink(tmpName);
+		return;
+	}
+	fclose(fd);
+
+	if (rename(tmpName, cacheFile))
+	{
+		printf("%s: Unable to rename %s\n", __FUNCTION__, tmpName);
+		unlink(tmpName);
+		return;
+	}
+	printf("PEB cache %s written\n", cacheFile);
+}
+
+/**
+ * qsort helper: compare 2 erase counters
+ */
+static int peb_leb_ec_cmp(const void *a, const void *b)
+{
+	const uint32_t ec1 = *(const uint32_t *)a;
+	const uint32_t ec2 = *(const uint32_t *)b;
+
+	return (ec1 > ec2) - (ec1 < ec2);
+}
+
+/**
+ * Print the wear of the flash: erase counter statistics and histogram
+ * Erase counters are read with the PEB/LEB information, no more I/O
+ */
+void peb_leb_print_wear(void)
+{
+	uint32_t *sorted;
+	uint64_t  sum = 0;
+	uint32_t  min, max, step;
+	int       histo[WEAR_HISTO_BARS];
+	int       nb = 0;
+	int       bar;
+	int       i;
+
+	sorted = malloc(pebNumber * sizeof(*sorted));
+	if (sorted == NULL)
+	{
+		return;
+	}
+	for (i=0; i<pebNumber; i++)
+	{
+		if (ecList[i] != PEB_EC_UNKNOWN)
+		{
+			sorted[nb++] = ecList[i];
+			sum         += ecList[i];
+		}
+	}
+	if (nb == 0)
+	{
+		printf("Wear: no erase counter\n");
+		free(sorted);
+		return;
+	}
+	qsort(sorted, nb, sizeof(*sorted), peb_leb_ec_cmp);
+
+	min = sorted[0];
+	max = sorted[nb - 1];
+	printf("Wear: %d PEB, erase counter min:%u max:%u mean:%llu p50:%u p90:%u p99:%u\n",
+			nb,
+			min,
+			max,
+			(unsigned long long)(sum / nb),
+			sorted[(nb - 1) * 50 / 100],
+			sorted[(nb - 1) * 90 / 100],
+			sorted[(nb - 1) * 99 / 100]);
+
+	/* Linear histogram between min and max */
+	memset(histo, 0, sizeof(histo));
+	step = (max - min) / WEAR_HISTO_BARS + 1;
+	for (i=0; i<nb; i++)
+	{
+		histo[(sorted[i] - min) / step]++;
+	}
+	for (bar=0; bar<WEAR_HISTO_BARS; bar++)
+	{
+		if (histo[bar] != 0)
+		{
+			printf("  ec %8u..%8u: %d PEB\n",
+					min + bar * step,
+					min + (bar + 1) * step - 1,
+					histo[bar]);
+		}
+	}
+	free(sorted);
+}
+
+/**
+ * Read data's of a PEB, from the image or the MTD device
+ * Return 0 or a negative error code, buf is then filled with 0xFF (like
+ * the EBADMSG of ubifs_leb_read)
+ */
+static int peb_leb_read_peb(int peb, void *buf, int offs, int len)
+{
+	off64_t pos;
+	ssize_t ret;
+	int     err = 0;
+
+	if ( (offs < 0) || (len < 0) || (offs + len > mtd.eb_size) )
+	{
+		return -EINVAL;
+	}
+
+	pos = (off64_t)peb * mtd.eb_size + offs;
+	if (imageMap != NULL)
+	{
+		memcpy(buf, imageMap + pos, len);
+		return 0;
+	}
+
+	ret = pread64(rawFd, buf, len, pos);
+	if (ret < 0)
+	{
+		err = -errno;
+	}
+	else if (ret != len)
+	{
+		err = -EIO;
+	}
+	if (err)
+	{
+		/* No stale data's in buf */
+		memset(buf, 0xFF, len);
+	}
+	return err;
+}
+
+/**
+ * Read the UBI volume table (LEB 0 of the layout volume)
+ * See peb_leb_get_vol_info, nothing printed if the volume is not found
+ */
+static int peb_leb_read_vtbl(int volId, int *rsvdLebs, char *name)
+{
+	struct ubi_vtbl_record vtbl;
+	int layout = -1;
+	int nbRecord;
+	int nameLen;
+	int i;
+
+	for (i=0; i<pebNumber; i++)
+	{
+		if ( (pebList[i].lnum == 0) && (pebList[i].vol_id == UBI_LAYOUT_VOLUME_ID) )
+		{
+			layout = i;
+			break;
+		}
+	}
+	if (layout < 0)
+	{
+		printf("%s: No layout volume\n", __FUNCTION__);
+		return -1;
+	}
+
+	nbRecord = (mtd.eb_size - pebList[layout].data_offset) / UBI_VTBL_RECORD_SIZE;
+	if (nbRecord > UBI_MAX_VOLUMES)
+	{
+		nbRecord = UBI_MAX_VOLUMES;
+	}
+
+	for (i=0; i<nbRecord; i++)
+	{
+		if (peb_leb_read_peb(
+				layout,
+				&vtbl,
+				pebList[layout].data_offset + i * UBI_VTBL_RECORD_SIZE,
+				sizeof(vtbl)) < 0)
+		{
+			printf("%s: Unable to read the volume table\n", __FUNCTION__);
+			return -1;
+		}
+
+		/* Empty record */
+		if (vtbl.reserved_pebs == 0)
+		{
+			continue;
+		}
+		if ( (volId >= 0) && (volId != i) )
+		{
+			continue;
+		}
+
+		nameLen = __builtin_bswap16(vtbl.name_len);
+		if (nameLen > UBI_VOL_NAME_MAX)
+		{
+			nameLen = UBI_VOL_NAME_MAX;
+		}
+		memcpy(name, vtbl.name, nameLen);
+		name[nameLen] = '\0';
+		(*rsvdLebs)   = __builtin_bswap32(vtbl.reserved_pebs);
+
+		return i;
+	}
+	return -1;
+}
+
+
+/**
+ * Return the volume to index
+ * Without a volume set, the first volume of the volume table (not all the
+ * user volumes: LEB of different volumes would collide)
+ * Needs imageMap or rawFd to read the volume table, else -1: all the user
+ * volumes are indexed
+ */
+static int peb_leb_resolve_vol_id(void)
+{
+	char name[UBI_VOL_NAME_MAX + 1];
+	int  rsvdLebs;
+	int  volId;
+
+	if ( (volIdToIndex >= 0) || (!peb_leb_is_raw()) )
+	{
+		return volIdToIndex;
+	}
+
+	volId = peb_leb_read_vtbl(-1, &rsvdLebs, name);
+	if (volId >= 0)
+	{
+		printf("Indexing volume %d\n", volId);
+	}
+	return volId;
+}
+
+/**
+ * Read the PEB/LEB information of the opened device
+ * mtd structure must be filled
+ * Return 0 or -ENOMEM (nothing loaded)
+ */
+static int peb_leb_load(const int fd)
+{
+	int i;
+
+	/* Save the erasable counter */
+	pebNumber = mtd.eb_cnt;
+
+	printf("Total Size:%lld\n", mtd.size);
+	printf("Erase Size:%d\n",   mtd.eb_size);
+	printf("Write Size:%d\n",   mtd.min_io_size);
+	printf("Number of PEB:%d\n", pebNumber);
+	printf("CRC32:%s%s\n", crc32_fast_name(), hdrCrcCheck ? " (header CRC checked)" : "");
+
+	/* Allocate area with zero */
+	pebList = calloc(pebNumber, sizeof(*pebList));
+	ecList  = malloc(pebNumber * sizeof(*ecList));
+	if ( (pebList == NULL) || (ecList == NULL) )
+	{
+		printf("%s: Unable to allocate the PEB table\n", __FUNCTION__);
+		goto nomem;
+	}
+
+	/* Initialise all PEB with an invalid LEB information */
+	for (i=0; i<pebNumber; i++)
+	{
+		pebList[i].lnum = LNUM_NOT_INIT;
+		ecList[i]       = PEB_EC_UNKNOWN;
+	}
+
+	if (peb_leb_read_bad_blocks(fd))
+	{
+		goto nomem;
+	}
+
+	printf("Reading PEB LEB link\n");
+	peb_leb_learn_hdr_layout(fd);
+	/* Cache not usable: the device must be read */
+	if (peb_leb_cache_load(fd) != 0)
+	{
+		if (peb_leb_fastmap(fd))
+		{
+			/* No usable fastmap: restart from a clean table */
+			for (i=0; i<pebNumber; i++)
+			{
+				pebList[i].lnum = LNUM_NOT_INIT;
+			}
+			peb_leb_scan(fd);
+		}
+		peb_leb_cache_save();
+	}
+
+	peb_leb_check();
+	peb_leb_build_index(fd, peb_leb_resolve_vol_id());
+	peb_leb_print_wear();
+#ifdef PEB_LEB_SHOW
+	peb_leb_show();
+#endif
+	return 0;
+
+nomem:
+	free(pebList);
+	free(ecList);
+	free(badBlocks);
+	pebList   = NULL;
+	ecList    = NULL;
+	badBlocks = NULL;
+	return -ENOMEM;
+}
+
+/**
+ * Open the MTD device and read the PEB/LEB information
+ * use ioctl MEMGETINFO
+ * keepOpen: the device is kept open to read LEB with peb_leb_read_leb
+ */
+static int peb_leb_open_mtd(const char *mtd_device, const int keepOpen)
+{
+	libmtd_t mtd_desc;
+	int fd;
+
+
+	if (pebList == NULL)
+	{
+		/* Initialize libmtd */
+		mtd_desc = libmtd_open();
+		if (!mtd_desc)
+		{
+			printf("can't initialize libmtd\n");
+			return __LINE__;
+		}
+
+		/* Open the device in read only mode */
+		printf("Opening %s in RDONLY\n", mtd_device);
+ 		fd = open(mtd_device, O_RDONLY);
+                if (fd < 0)
+                {
+                        printf("%s: Unable to open %s\n", __FUNCTION__, mtd_device);
+                        return __LINE__;
+                }
+
+		/* Fill in MTD device capability structure */
+		if (mtd_get_dev_info(mtd_desc, mtd_device, &mtd) < 0)
+		{
+			printf("%s: Error mtd_get_dev_info\n", __FUNCTION__);
+                        return __LINE__;
+		}
+
+		/* Before the load: the volume table is read with peb_leb_read_peb */
+		if (keepOpen)
+		{
+			rawFd = fd;
+		}
+
+		if (peb_leb_load(fd))
+		{
+			rawFd = -1;
+			close(fd);
+			return __LINE__;
+		}
+
+		if (!keepOpen)
+		{
+			close(fd);
+		}
+
+		printf("end\n");
+	}
+	else
+	{
+		printf("%s: already initialized\n", __FUNCTION__);
+	}
+	return 0;
+}
+
+/**
+ * Initialize the PEB/LEB information
+ */
+int peb_leb_init(const char *mtd_device)
+{
+	return peb_leb_open_mtd(mtd_device, 0);
+}
+
+/**
+ * Initialize the PEB/LEB information, and keep the MTD device open
+ * to read the LEB without UBI (peb_leb_read_leb)
+ */
+int peb_leb_init_raw(const char *mtd_device)
+{
+	return peb_leb_open_mtd(mtd_device, 1);
+}
+
+/**
+ * Read the geometry of an image in its sidecar file "<image>.geometry"
+ * Format: "eb_size=<bytes>" and "min_io_size=<bytes>" lines
+ */
+static int peb_leb_read_geometry(const char *image, int *ebSize, int *minIoSize)
+{
+	char  fileName[400];
+	char  line[100];
+	FILE *fd;
+
+	snprintf(fileName, sizeof(fileName), "%s.geometry", image);
+	fd = fopen(fileName, "r");
+	if (fd == NULL)
+	{
+		printf("%s: No geometry given and unable to open %s\n", __FUNCTION__, fileName);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fd) != NULL)
+	{
+		sscanf(line, "eb_size=%i", ebSize);
+		sscanf(line, "min_io_size=%i", minIoSize);
+	}
+	fclose(fd);
+
+	return 0;
+}
+
+/**
+ * Initialize the PEB/LEB information from a raw NAND image (nanddump
+ * without OOB) instead of a MTD device
+ * The image is mapped in memory, LEB are read with peb_leb_read_leb
+ * ebSize, minIoSize: geometry of the NAND, <= 0 to read the sidecar file
+ */
+int peb_leb_init_image(const char *image, int ebSize, int minIoSize)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	if (pebList != NULL)
+	{
+		printf("%s: already initialized\n", __FUNCTION__);
+		return 0;
+	}
+
+	if ( ( (ebSize <= 0) || (minIoSize <= 0) ) &&
+	     peb_leb_read_geometry(image, &ebSize, &minIoSize) )
+	{
+		return __LINE__;
+	}
+	if ( (ebSize <= 0) || (minIoSize <= 0) || (ebSize % minIoSize) )
+	{
+		printf("%s: Bad geometry eb_size:%d min_io_size:%d\n", __FUNCTION__, ebSize, minIoSize);
+		return __LINE__;
+	}
+
+	printf("Opening image %s in RDONLY\n", image);
+	fd = open(image, O_RDONLY);
+	if (fd < 0)
+	{
+		printf("%s: Unable to open %s\n", __FUNCTION__, image);
+		return __LINE__;
+	}
+	if ( (fstat(fd, &st) != 0) || (st.st_size < ebSize) )
+	{
+		printf("%s: Bad image size\n", __FUNCTION__);
+		close(fd);
+		return __LINE__;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		printf("%s: Unable to map %s\n", __FUNCTION__, image);
+		close(fd);
+		return __LINE__;
+	}
+	/* The whole image is read */
+	madvise(map, st.st_size, MADV_WILLNEED);
+	imageMap     = map;
+	imageMapSize = st.st_size;
+
+	/* Build the MTD information from the geometry */
+	memset(&mtd, 0, sizeof(mtd));
+	mtd.size        = st.st_size - (st.st_size % ebSize);
+	mtd.eb_size     = ebSize;
+	mtd.eb_cnt      = mtd.size / ebSize;
+	mtd.min_io_size = minIoSize;
+
+	if (peb_leb_load(fd))
+	{
+		munmap(map, st.st_size);
+		imageMap     = NULL;
+		imageMapSize = 0;
+		close(fd);
+		return __LINE__;
+	}
+
+	close(fd);
+
+	printf("end\n");
+	return 0;
+}
+
+/**
+ * Release the PEB/LEB information: tables, mapped image or cache, and the
+ * MTD device kept open, peb_leb_init may then be called again
+ */
+void peb_leb_close(void)
+{
+	if (cacheMap != NULL)
+	{
+		munmap(cacheMap, cacheMapSize);
+	}
+	else
+	{
+		free(pebList);
+		free(ecList);
+	}
+	if (imageMap != NULL)
+	{
+		munmap((void *)imageMap, imageMapSize);
+	}
+	if (rawFd >= 0)
+	{
+		close(rawFd);
+	}
+	free(lebList);
+	free(badBlocks);
+
+	pebList      = NULL;
+	ecList       = NULL;
+	cacheMap     = NULL;
+	cacheMapSize = 0;
+	imageMap     = NULL;
+	imageMapSize = 0;
+	rawFd        = -1;
+	lebList      = NULL;
+	lebNumber    = -1;
+	badBlocks    = NULL;
+	pebNumber    = -1;
+}
+
+/**
+ * Read data's of a LEB, without UBI
+ * An unmapped LEB is read as erased (like UBI does)
+ * Return 0 or a negative error code
+ */
+int peb_leb_read_leb(int lnum, void *buf, int offs, int len)
+{
+	int peb;
+
+	peb = peb_leb_getPeb(lnum);
+	if (peb < 0)
+	{
+		memset(buf, 0xFF, len);
+		return 0;
+	}
+
+	return peb_leb_read_peb(peb, buf, pebList[peb].data_offset + offs, len);
+}
+
+/**
+ * Return a pointer to a LEB range inside the mapped image, without copy
+ * NULL if not reading an image, LEB not mapped or range out of the PEB
+ * The pointer is valid until the end of the program (read only)
+ */
+const void *peb_leb_map_leb(int lnum, int offs, int len)
+{
+	int peb;
+
+	if (imageMap == NULL)
+	{
+		return NULL;
+	}
+
+	peb = peb_leb_getPeb(lnum);
+	if (peb < 0)
+	{
+		return NULL;
+	}
+
+	offs += pebList[peb].data_offset;
+	if ( (offs < 0) || (len < 0) || (offs + len > mtd.eb_size) )
+	{
+		return NULL;
+	}
+	return imageMap + (off64_t)peb * mtd.eb_size + offs;
+}
+
+/**
+ * Return 1 if the LEB is mapped to a PEB
+ */
+int peb_leb_is_mapped(int lnum)
+{
+	return peb_leb_getPeb(lnum) >= 0;
+}
+
+/**
+ * Return 1 if the LEB is read with peb_leb_read_leb (no UBI)
+ */
+int peb_leb_is_raw(void)
+{
+	return (imageMap != NULL) || (rawFd >= 0);
+}
+
+/**
+ * Return 1 if the LEB are read from a memory mapped image
+ */
+int peb_leb_is_image(void)
+{
+	return imageMap != NULL;
+}
+
+/**
+ * Read the UBI volume table (LEB 0 of the layout volume)
+ * volId: volume to look for, -1 for the first volume
+ * rsvdLebs: receive the number of LEB reserved for the volume
+ * name: receive the volume name (UBI_VOL_NAME_MAX + 1 bytes)
+ * Return the volume ID or -1 if not found
+ */
+int peb_leb_get_vol_info(int volId, int *rsvdLebs, char *name)
+{
+	int found;
+
+	found = peb_leb_read_vtbl(volId, rsvdLebs, name);
+	if (found < 0)
+	{
+		printf("%s: Volume %d not found\n", __FUNCTION__, volId);
+		return -1;
+	}
+
+	printf("Volume %d \"%s\": %d LEB\n", found, name, *rsvdLebs);
+	return found;
+}
+
+/**
+ * Return the LEB size (PEB size without the UBI headers)
+ */
+int peb_leb_get_leb_size(void)
+{
+	return mtd.eb_size - lebDataOffset;
+}
+
+/**
+ * Return the minimal I/O size of the MTD device
+ */
+int peb_leb_get_min_io_size(void)
+{
+	return mtd.min_io_size;
+}
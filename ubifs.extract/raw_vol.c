@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * This file is part of UBIFS.
+ *
+ * Copyright (C) 2025 AIRBUS Defence & Space
+ *
+ * Authors: Frederic Fraysse
+ */
+
+
+#include "ads_dump.h"
+
+#include <mtd/ubi-media.h>
+#include <mtd/ubi-user.h>
+
+
+/* Raw NAND image to use instead of an UBI volume, NULL: UBI volume */
+static const char *imageFile = NULL;
+
+/* Read the MTD device without UBI, instead of an UBI volume */
+static int rawMtd = 0;
+
+/* Geometry of the NAND of the image, -1: read from the sidecar file */
+static int geoEbSize    = -1;
+static int geoMinIoSize = -1;
+
+/* UBI volume containing the UBIFS, -1: the first volume */
+static int rawVolId = -1;
+
+
+/**
+ * Set the raw NAND image (nanddump without OOB) to use
+ */
+void raw_vol_set_image(const char *image)
+{
+	imageFile = image;
+}
+
+/**
+ * Read the UBIFS from the MTD device without attaching UBI
+ */
+void raw_vol_set_raw_mtd(int enable)
+{
+	rawMtd = enable;
+}
+
+/**
+ * Set the geometry of the NAND of the image
+ */
+void raw_vol_set_geometry(int ebSize, int minIoSize)
+{
+	geoEbSize    = ebSize;
+	geoMinIoSize = minIoSize;
+}
+
+/**
+ * Set the UBI volume containing the UBIFS
+ */
+void raw_vol_set_vol_id(int volId)
+{
+	rawVolId = volId;
+}
+
+/**
+ * Return 1 if the UBIFS is read without UBI
+ */
+int raw_vol_is_enabled(void)
+{
+	return (imageFile != NULL) || rawMtd;
+}
+
+/**
+ * Replace ubifs_open_volume: the UBI volume and device information are
+ * built from the PEB/LEB table and the UBI volume table of the raw image
+ * or of the MTD device (no ubiattach needed)
+ * ubifs_leb_read then reads the LEB through the PEB/LEB table
+ */
+int raw_vol_open(struct ubifs_info *c)
+{
+	char name[UBI_VOL_NAME_MAX + 1];
+	int  rsvdLebs;
+	int  volId;
+	int  err;
+
+	peb_leb_set_vol_id(rawVolId);
+	if (imageFile != NULL)
+	{
+		err = peb_leb_init_image(imageFile, geoEbSize, geoMinIoSize);
+	}
+	else
+	{
+		err = peb_leb_init_raw(ads_get_mtd_device());
+	}
+	if (err)
+	{
+		printf("Error peb_leb_init return:%d\n", err);
+		return -EINVAL;
+	}
+
+	volId = peb_leb_get_vol_info(rawVolId, &rsvdLebs, name);
+	if (volId < 0)
+	{
+		peb_leb_close();
+		return -ENODEV;
+	}
+
+	memset(&c->vi, 0, sizeof(c->vi));
+	c->vi.vol_id     = volId;
+	c->vi.type       = UBI_DYNAMIC_VOLUME;
+	c->vi.alignment  = 1;
+	c->vi.rsvd_lebs  = rsvdLebs;
+	c->vi.leb_size   = peb_leb_get_leb_size();
+	c->vi.rsvd_bytes = (long long)rsvdLebs * c->vi.leb_size;
+	c->vi.data_bytes = c->vi.rsvd_bytes;
+	snprintf(c->vi.name, sizeof(c->vi.name), "%s", name);
+
+	memset(&c->di, 0, sizeof(c->di));
+	c->di.eb_size     = peb_leb_get_eb_size();
+	c->di.leb_size    = c->vi.leb_size;
+	c->di.min_io_size = peb_leb_get_min_io_size();
+
+	/* No UBI device */
+	c->libubi = NULL;
+	c->dev_fd = -1;
+
+	printf("UBIFS read from %s without UBI (volume %d, LEB size %d)\n",
+			(imageFile != NULL) ? imageFile : ads_get_mtd_device(),
+			volId,
+			c->vi.leb_size);
+	return 0;
+}
+
+/**
+ * Replace ubifs_close_volume: release the image mapping or the MTD device
+ */
+void raw_vol_close(struct ubifs_info *c)
+{
+	peb_leb_close();
+	c->dev_fd = -1;
+}
@@ -0,0 +1,315 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * This file is part of UBIFS.
+ *
+ * Copyright (C) 2025 AIRBUS Defence & Space
+ *
+ * Authors: Frederic Fraysse
+ */
+
+/*
+ * Read planner: a batch of node reads is sorted by LEB and offset, each
+ * read is widened to the flash pages (min_io_size) and the adjacent or
+ * overlapping reads are merged in a single device read.
+ * Two nodes in the same NAND page then cost one page read (and one ECC
+ * decode) instead of two.
+ * The merged reads of a batch are queued together (leb_aio): with io_uring
+ * they are in flight at the same time.
+ */
+
+#include "ads_dump.h"
+
+#include <pthread.h>
+
+
+/* Maximum size of a merged read */
+#define READ_PLAN_MAX_SPAN (256 * 1024)
+
+/* Statistics of the planner */
+static struct
+{
+	/* Requests and their bytes */
+	unsigned long long reqs;
+	unsigned long long reqBytes;
+
+	/* Pages which would be read with one read per request */
+	unsigned long long naivePages;
+
+	/* Device reads done and their pages */
+	unsigned long long reads;
+	unsigned long long pages;
+
+	/* Merged reads in error, requests read again one by one */
+	unsigned long long fallbacks;
+}
+planStats;
+
+static pthread_mutex_t planLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Position of a request, to sort them */
+struct read_plan_pos
+{
+	int lnum;
+	int offs;
+	int idx;
+};
+
+
+/**
+ * qsort: order of the requests on the flash
+ */
+static int read_plan_cmp(const void *a, const void *b)
+{
+	const struct read_plan_pos *pa = a;
+	const struct read_plan_pos *pb = b;
+
+	if (pa->lnum != pb->lnum)
+	{
+		return (pa->lnum < pb->lnum) ? -1 : 1;
+	}
+	return (pa->offs < pb->offs) ? -1 : (pa->offs > pb->offs);
+}
+
+/**
+ * Run a list of reads through the queue: all submitted (waiting for a
+ * completion when the queue is full), then all completed
+ * Return 0 or the error of the queue
+ */
+static int read_plan_run(struct leb_aio *aio, struct leb_aio_req *reads, int nb)
+{
+	struct leb_aio_req *done;
+	int ret;
+	int i;
+
+	for (i=0; i<nb; i++)
+	{
+		while ((ret = leb_aio_submit(aio, &reads[i])) == -EBUSY)
+		{
+			ret = leb_aio_complete(aio, &done);
+			if (ret < 0)
+			{
+				return ret;
+			}
+		}
+	}
+	while ((ret = leb_aio_complete(aio, &done)) > 0)
+	{
+	}
+	return ret;
+}
+
+/**
+ * Read a batch of requests, the merged reads queued together on aio
+ * (io_uring if enabled)
+ * Each request gets its data and its error in req->err, like ubifs_leb_read
+ * If a merged read fails, its requests are read one by one to keep the
+ * error of each request
+ * Return 0, -ENOMEM or the error of the queue
+ */
+int read_plan_execute(const struct ubifs_info *c, struct leb_aio *aio,
+		      struct read_plan_req *reqs, int nb)
+{
+	struct read_plan_req *r;
+	struct read_plan_pos *pos;
+	struct leb_aio_req *spans;
+	struct leb_aio_req *retries;
+	uint8_t *spanBuf = NULL;
+	int *order;
+	int *spanLast;
+	int ioSize;
+	int first, last, i, s;
+	int nbSpans = 0, nbRetries = 0;
+	int spanStart, spanEnd, start, end;
+	size_t spanBytes = 0;
+	int ret;
+	unsigned long long naivePages = 0, reqBytes = 0, reads = 0, pages = 0, fallbacks = 0;
+
+	if (nb <= 0)
+	{
+		return 0;
+	}
+
+	pos      = malloc(nb * sizeof(*pos));
+	order    = malloc(nb * sizeof(*order));
+	spans    = calloc(nb, sizeof(*spans));
+	spanLast = malloc(nb * sizeof(*spanLast));
+	retries  = calloc(nb, sizeof(*retries));
+	if ( (pos == NULL) || (order == NULL) || (spans == NULL) || (spanLast == NULL) || (retries == NULL) )
+	{
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ioSize = (c->min_io_size > 0) ? c->min_io_size : 1;
+
+	for (i=0; i<nb; i++)
+	{
+		pos[i].lnum = reqs[i].lnum;
+		pos[i].offs = reqs[i].offs;
+		pos[i].idx  = i;
+		reqs[i].err = 0;
+		start = reqs[i].offs / ioSize * ioSize;
+		end   = (reqs[i].offs + reqs[i].len + ioSize - 1) / ioSize * ioSize;
+		naivePages += (end - start) / ioSize;
+		reqBytes   += reqs[i].len;
+	}
+
+	qsort(pos, nb, sizeof(*pos), read_plan_cmp);
+	for (i=0; i<nb; i++)
+	{
+		order[i] = pos[i].idx;
+	}
+
+	/* Plan the merged reads */
+	first = 0;
+	while (first < nb)
+	{
+		/* Widen the first request to the pages */
+		r = &reqs[order[first]];
+		spanStart = r->offs / ioSize * ioSize;
+		spanEnd   = (r->offs + r->len + ioSize - 1) / ioSize * ioSize;
+
+		/* Merge the next requests of the same LEB touching the span */
+		for (last = first + 1; last < nb; last++)
+		{
+			r     = &reqs[order[last]];
+			start = r->offs / ioSize * ioSize;
+			end   = (r->offs + r->len + ioSize - 1) / ioSize * ioSize;
+			if ( (r->lnum != reqs[order[first]].lnum) ||
+			     (start > spanEnd) ||
+			     (((end > spanEnd) ? end : spanEnd) - spanStart > READ_PLAN_MAX_SPAN) )
+			{
+				break;
+			}
+			if (end > spanEnd)
+			{
+				spanEnd = end;
+			}
+		}
+		if (spanEnd > c->leb_size)
+		{
+			spanEnd = c->leb_size;
+		}
+
+		r = &reqs[order[first]];
+		spans[nbSpans].lnum = r->lnum;
+		if (spanEnd - spanStart > READ_PLAN_MAX_SPAN)
+		{
+			/* A request alone and larger than the span buffer: read directly */
+			spans[nbSpans].offs = r->offs;
+			spans[nbSpans].len  = r->len;
+			spans[nbSpans].buf  = r->buf;
+		}
+		else
+		{
+			/* Place in spanBuf, set once its size is known */
+			spans[nbSpans].offs = spanStart;
+			spans[nbSpans].len  = spanEnd - spanStart;
+			spans[nbSpans].priv = (void *)spanBytes;
+			spanBytes += spanEnd - spanStart;
+		}
+		spanLast[nbSpans] = last;
+		nbSpans++;
+		reads++;
+		pages += (spanEnd - spanStart + ioSize - 1) / ioSize;
+		first = last;
+	}
+
+	spanBuf = malloc(spanBytes ? spanBytes : 1);
+	if (spanBuf == NULL)
+	{
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (s=0; s<nbSpans; s++)
+	{
+		if (spans[s].buf == NULL)
+		{
+			spans[s].buf = spanBuf + (size_t)spans[s].priv;
+		}
+	}
+
+	ret = read_plan_run(aio, spans, nbSpans);
+	if (ret)
+	{
+		goto out;
+	}
+
+	/* Give each request its data */
+	first = 0;
+	for (s=0; s<nbSpans; s++)
+	{
+		for (i=first; i<spanLast[s]; i++)
+		{
+			r = &reqs[order[i]];
+			if (spans[s].buf == r->buf)
+			{
+				r->err = spans[s].err;
+			}
+			else if (spans[s].err == 0)
+			{
+				memcpy(r->buf, (uint8_t *)spans[s].buf + (r->offs - spans[s].offs), r->len);
+			}
+			else
+			{
+				/* Keep the error of each request */
+				retries[nbRetries].lnum = r->lnum;
+				retries[nbRetries].offs = r->offs;
+				retries[nbRetries].len  = r->len;
+				retries[nbRetries].buf  = r->buf;
+				retries[nbRetries].priv = r;
+				nbRetries++;
+			}
+		}
+		first = spanLast[s];
+	}
+
+	ret = read_plan_run(aio, retries, nbRetries);
+	for (i=0; i<nbRetries; i++)
+	{
+		((struct read_plan_req *)retries[i].priv)->err = retries[i].err;
+	}
+	fallbacks = nbRetries;
+
+out:
+	free(pos);
+	free(order);
+	free(spans);
+	free(spanLast);
+	free(retries);
+	free(spanBuf);
+	if (ret == -ENOMEM)
+	{
+		return ret;
+	}
+
+	pthread_mutex_lock(&planLock);
+	planStats.reqs       += nb;
+	planStats.reqBytes   += reqBytes;
+	planStats.naivePages += naivePages;
+	planStats.reads      += reads;
+	planStats.pages      += pages;
+	planStats.fallbacks  += fallbacks;
+	pthread_mutex_unlock(&planLock);
+	return ret;
+}
+
+/**
+ * Print the statistics of the planner
+ */
+void read_plan_print_stats(void)
+{
+	pthread_mutex_lock(&planLock);
+	if (planStats.reqs > 0)
+	{
+		printf("Read planner: %llu requests (%llu bytes) in %llu reads, %llu pages read instead of %llu (%.1f%% saved), %llu requests read again\n",
+				planStats.reqs,
+				planStats.reqBytes,
+				planStats.reads,
+				planStats.pages,
+				planStats.naivePages,
+				planStats.naivePages ? (100.0 * ((double)planStats.naivePages - planStats.pages) / planStats.naivePages) : 0.0,
+				planStats.fallbacks);
+	}
+	pthread_mutex_unlock(&planLock);
+}